@@ -0,0 +1,54 @@
+include($$top_srcdir/scripted.pri)
+include(../lua/lua.pri)
+
+# Command-line tool that validates and re-saves scripts.  It uses the editor's
+# non-GUI sources directly.
+
+QT       += core gui
+QT       -= widgets
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = scripted-batch
+TEMPLATE = app
+
+DEFINES += EDITOR_NO_GUI
+
+INCLUDEPATH += ../editor
+DEPENDPATH += ../editor
+
+SOURCES += main.cpp \
+    ../editor/filesystemwatcher.cpp \
+    ../editor/luacache.cpp \
+    ../editor/luafileloader.cpp \
+    ../editor/luamanager.cpp \
+    ../editor/luautils.cpp \
+    ../editor/metaeventmanager.cpp \
+    ../editor/node.cpp \
+    ../editor/preferences.cpp \
+    ../editor/project.cpp \
+    ../editor/projectreader.cpp \
+    ../editor/projectwriter.cpp \
+    ../editor/scriptmanager.cpp \
+    ../editor/scriptvariable.cpp \
+    ../editor/symboltable.cpp
+
+HEADERS += \
+    ../editor/editor_global.h \
+    ../editor/filesystemwatcher.h \
+    ../editor/luacache.h \
+    ../editor/luafileloader.h \
+    ../editor/luamanager.h \
+    ../editor/luautils.h \
+    ../editor/metaeventmanager.h \
+    ../editor/node.h \
+    ../editor/preferences.h \
+    ../editor/project.h \
+    ../editor/projectbinary.h \
+    ../editor/projectreader.h \
+    ../editor/projectwriter.h \
+    ../editor/scriptmanager.h \
+    ../editor/scriptvariable.h \
+    ../editor/singleton.h \
+    ../editor/symboltable.h
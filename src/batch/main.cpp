@@ -0,0 +1,296 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Validates and re-saves scripts without the GUI.  Reading and writing run on
+// a pool of worker threads.  Looking up the Lua, event and script files the
+// nodes come from uses the manager singletons, so that part runs on the main
+// thread.
+
+#include "luamanager.h"
+#include "luautils.h"
+#include "metaeventmanager.h"
+#include "node.h"
+#include "preferences.h"
+#include "project.h"
+#include "projectreader.h"
+#include "projectwriter.h"
+#include "scriptmanager.h"
+#include "scriptvariable.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <stdio.h>
+
+class FileResult
+{
+public:
+    FileResult() : mProject(0), mNanoseconds(0) {}
+    QString mPath;
+    Project *mProject;
+    QString mError; // reading or writing failed
+    QStringList mProblems; // unknown nodes, ports and variables
+    qint64 mNanoseconds;
+};
+
+typedef void (*FileFunction)(FileResult *result);
+
+class FileJob : public QRunnable
+{
+public:
+    FileJob(FileFunction function, FileResult *result) :
+        mFunction(function),
+        mResult(result)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        mFunction(mResult);
+        mResult->mNanoseconds += timer.nsecsElapsed();
+    }
+
+private:
+    FileFunction mFunction;
+    FileResult *mResult;
+};
+
+// The vector isn't resized while the jobs run, so each job can safely write
+// to its own element.
+static void runJobs(FileFunction function, QVector<FileResult> &results, int threadCount)
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
+    for (int i = 0; i < results.size(); i++) {
+        if (results[i].mError.isEmpty() && results[i].mProblems.isEmpty())
+            pool.start(new FileJob(function, &results[i]));
+    }
+    pool.waitForDone();
+}
+
+static void readFile(FileResult *result)
+{
+    ProjectReader reader;
+    result->mProject = reader.read(result->mPath);
+    if (!result->mProject)
+        result->mError = reader.errorString();
+}
+
+static void writeFile(FileResult *result)
+{
+    ProjectWriter writer;
+    if (!writer.write(result->mProject, result->mPath))
+        result->mError = writer.errorString();
+}
+
+static QString describe(BaseNode *node)
+{
+    return QString(QLatin1String("node %1 \"%2\"")).arg(node->id()).arg(node->label());
+}
+
+static QString sourceOf(BaseNode *node, bool *known)
+{
+    if (LuaNode *lnode = node->asLuaNode()) {
+        *known = lnode->info() && lnode->info()->node();
+        return lnode->source();
+    }
+    if (MetaEventNode *enode = node->asEventNode()) {
+        *known = enode->info() && enode->info()->node();
+        return enode->source() + QLatin1Char(':') + enode->eventName();
+    }
+    if (ScriptNode *snode = node->asScriptNode()) {
+        *known = snode->info() && snode->info()->node();
+        return snode->source();
+    }
+    *known = false;
+    return QString();
+}
+
+static void validate(FileResult *result)
+{
+    QStringList &problems = result->mProblems;
+    ScriptNode *root = result->mProject->rootNode();
+
+    foreach (NodeInput *input, root->inputs())
+        if (input->hasBadConnections())
+            problems += QString(QLatin1String("input \"%1\": connected to an unknown input")).arg(input->name());
+    foreach (NodeOutput *output, root->outputs())
+        if (output->hasBadConnections())
+            problems += QString(QLatin1String("output \"%1\": connected to an unknown input")).arg(output->name());
+
+    foreach (BaseNode *node, root->nodes()) {
+        bool known;
+        QString source = sourceOf(node, &known);
+        if (!known) {
+            problems += QString(QLatin1String("%1: unknown node %2")).arg(describe(node)).arg(source);
+            continue;
+        }
+        foreach (ScriptVariable *var, node->variables())
+            if (!var->isKnown())
+                problems += QString(QLatin1String("%1: unknown variable \"%2\"")).arg(describe(node)).arg(var->name());
+        foreach (NodeInput *input, node->inputs())
+            if (!input->isKnown())
+                problems += QString(QLatin1String("%1: unknown input \"%2\"")).arg(describe(node)).arg(input->name());
+        foreach (NodeOutput *output, node->outputs()) {
+            if (!output->isKnown())
+                problems += QString(QLatin1String("%1: unknown output \"%2\"")).arg(describe(node)).arg(output->name());
+            else if (output->hasBadConnections())
+                problems += QString(QLatin1String("%1: output \"%2\" is connected to an unknown input")).arg(describe(node)).arg(output->name());
+        }
+    }
+}
+
+static void addScripts(const QString &path, QStringList &paths)
+{
+    QFileInfo info(path);
+    if (!info.isDir()) {
+        paths += info.absoluteFilePath();
+        return;
+    }
+    QStringList filters;
+    filters << QLatin1String("*.pzs") << QLatin1String("*.pzsb");
+    QDirIterator it(path, filters, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+        paths += QFileInfo(it.next()).absoluteFilePath();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: scripted-batch [options] file-or-directory...\n"
+            "\n"
+            "Checks .pzs and .pzsb scripts for unknown nodes, inputs, outputs and\n"
+            "variables.  Directories are searched recursively.  Game directories are\n"
+            "taken from the editor's preferences.\n"
+            "\n"
+            "  --resave    write each valid script back after syncing it with its\n"
+            "              Lua, event and script files\n"
+            "  --jobs N    number of threads reading and writing scripts, the\n"
+            "              default is one per core\n"
+            "\n"
+            "The exit status is 1 if any script couldn't be read or written or has\n"
+            "unknown items, 2 for bad arguments.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    // Shares the editor's settings.
+    a.setOrganizationDomain(QLatin1String("TheIndieStone"));
+    a.setApplicationName(QLatin1String("PZDraft"));
+
+    bool resave = false;
+    int threadCount = 0;
+    QStringList paths;
+    QStringList args = a.arguments().mid(1);
+    for (int i = 0; i < args.size(); i++) {
+        if (args[i] == QLatin1String("--resave"))
+            resave = true;
+        else if (args[i] == QLatin1String("--jobs") && i + 1 < args.size())
+            threadCount = args[++i].toInt();
+        else if (args[i].startsWith(QLatin1Char('-'))) {
+            usage();
+            return 2;
+        } else
+            addScripts(args[i], paths);
+    }
+    if (paths.isEmpty()) {
+        usage();
+        return 2;
+    }
+
+    QElapsedTimer wallTimer;
+    wallTimer.start();
+
+    new Preferences;
+    new LuaStatePool;
+    new LuaBytecodeCache(prefs()->configPath(QLatin1String("scripted-luac")));
+    new ScriptManager;
+    new LuaManager;
+    new MetaEventManager;
+    luamgr()->readLuaFiles();
+    eventmgr()->readEventFiles();
+
+    QVector<FileResult> results(paths.size());
+    for (int i = 0; i < paths.size(); i++)
+        results[i].mPath = paths[i];
+
+    runJobs(readFile, results, threadCount);
+
+    for (int i = 0; i < results.size(); i++) {
+        FileResult &result = results[i];
+        if (!result.mProject)
+            continue;
+        QElapsedTimer timer;
+        timer.start();
+        result.mProject->resolveInfo();
+        validate(&result);
+        result.mNanoseconds += timer.nsecsElapsed();
+    }
+
+    if (resave)
+        runJobs(writeFile, results, threadCount);
+
+    int failed = 0;
+    qint64 totalNanoseconds = 0;
+    foreach (const FileResult &result, results) {
+        bool ok = result.mError.isEmpty() && result.mProblems.isEmpty();
+        if (!ok)
+            ++failed;
+        totalNanoseconds += result.mNanoseconds;
+        printf("%s %8.2f ms  %s\n", ok ? "OK  " : "FAIL", result.mNanoseconds / 1000000.0,
+               qPrintable(QDir::toNativeSeparators(result.mPath)));
+        if (!result.mError.isEmpty())
+            printf("    %s\n", qPrintable(result.mError));
+        foreach (const QString &problem, result.mProblems)
+            printf("    %s\n", qPrintable(problem));
+        delete result.mProject;
+    }
+
+    printf("%d scripts, %d OK, %d failed, %.2f ms in files, %.2f ms total\n",
+           results.size(), results.size() - failed, failed,
+           totalNanoseconds / 1000000.0, wallTimer.nsecsElapsed() / 1000000.0);
+    printf("Lua bytecode cache: %d hits, %d misses\n",
+           luaBytecodeCache()->hits(), luaBytecodeCache()->misses());
+
+    QMap<QString,qint64> peaks = luaStatePool()->peakBytes();
+    QString peakFile;
+    qint64 peak = 0;
+    for (QMap<QString,qint64>::const_iterator it = peaks.constBegin(); it != peaks.constEnd(); ++it) {
+        if (it.value() > peak) {
+            peak = it.value();
+            peakFile = it.key();
+        }
+    }
+    if (peak)
+        printf("Lua files: %d run, most memory %.1f KB for %s\n", peaks.size(),
+               peak / 1024.0, qPrintable(QDir::toNativeSeparators(peakFile)));
+
+    luamgr()->writeCache();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+include($$top_srcdir/scripted.pri)
+include(../lua/lua.pri)
+
+# Microbenchmarks for the editor's Lua and text code.  Like scripted-batch it
+# uses the editor's sources directly.  The Lua editor's highlighter needs
+# QtGui, but no window is shown.
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = scripted-bench
+TEMPLATE = app
+
+INCLUDEPATH += ../editor
+DEPENDPATH += ../editor
+
+SOURCES += main.cpp \
+    ../editor/luaeditor.cpp \
+    ../editor/luautils.cpp
+
+HEADERS += \
+    ../editor/editor_global.h \
+    ../editor/luaeditor.h \
+    ../editor/luautils.h \
+    ../editor/singleton.h
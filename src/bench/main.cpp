@@ -0,0 +1,522 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the editor's current code against the code it replaced.  The old code
+// only lives here now.
+
+#include "luaeditor.h"
+#include "luautils.h"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QRegExp>
+#include <QStringList>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+
+#include <stdio.h>
+
+/////
+
+// LuaState::toValue() as it was before LuaCursor: every key and value of a
+// table is copied into its own LuaValue.
+namespace OldLua {
+
+static int allocations = 0;
+
+class LuaValue;
+
+class LuaTableValue
+{
+public:
+    LuaTableValue() {}
+    LuaTableValue(const LuaTableValue &other);
+    ~LuaTableValue()
+    {
+        qDeleteAll(mKeys);
+        qDeleteAll(mValues);
+    }
+
+    // This appended to the existing entries instead of replacing them, which
+    // didn't matter because the target was always empty.
+    LuaTableValue &operator=(const LuaTableValue &other);
+
+    QList<LuaValue*> mKeys;
+    QList<LuaValue*> mValues;
+};
+
+class LuaValue
+{
+public:
+    LuaValue() :
+        mType(LUA_TNONE)
+    {
+    }
+
+    int mType;
+    double mNumberValue;
+    QString mStringValue;
+    bool mBooleanValue;
+    LuaTableValue mTableValue;
+};
+
+LuaTableValue::LuaTableValue(const LuaTableValue &other)
+{
+    foreach (LuaValue *v, other.mKeys) {
+        mKeys += new LuaValue(*v);
+        ++allocations;
+    }
+    foreach (LuaValue *v, other.mValues) {
+        mValues += new LuaValue(*v);
+        ++allocations;
+    }
+}
+
+LuaTableValue &LuaTableValue::operator=(const LuaTableValue &other)
+{
+    foreach (LuaValue *v, other.mKeys) {
+        mKeys += new LuaValue(*v);
+        ++allocations;
+    }
+    foreach (LuaValue *v, other.mValues) {
+        mValues += new LuaValue(*v);
+        ++allocations;
+    }
+    return *this;
+}
+
+static LuaTableValue toTableValue(lua_State *L, int stackIndex);
+
+static LuaValue toValue(lua_State *L, int stackIndex)
+{
+    if (stackIndex < 0)
+        stackIndex = lua_gettop(L) - qAbs(stackIndex) + 1;
+    LuaValue v;
+    v.mType = lua_type(L, stackIndex);
+    switch (v.mType) {
+    case LUA_TNUMBER:
+        v.mNumberValue = lua_tonumber(L, stackIndex);
+        break;
+    case LUA_TBOOLEAN:
+        v.mBooleanValue = lua_toboolean(L, stackIndex);
+        break;
+    case LUA_TSTRING:
+        v.mStringValue = QLatin1String(lua_tostring(L, stackIndex));
+        break;
+    case LUA_TTABLE:
+        v.mTableValue = toTableValue(L, stackIndex);
+        break;
+    }
+    return v;
+}
+
+static LuaTableValue toTableValue(lua_State *L, int stackIndex)
+{
+    LuaTableValue tv;
+    lua_pushnil(L); // space for key
+    while (lua_next(L, stackIndex) != 0) { // pop a key, push next key, push next value
+        tv.mKeys += new LuaValue(toValue(L, -2));
+        tv.mValues += new LuaValue(toValue(L, -1));
+        allocations += 2;
+        lua_pop(L, 1); // pop value
+    }
+    return tv;
+}
+
+// Returns the total length of the strings.
+static int visit(const LuaValue &v)
+{
+    int length = v.mStringValue.length();
+    for (int i = 0; i < v.mTableValue.mKeys.size(); i++)
+        length += visit(*v.mTableValue.mKeys[i]) + visit(*v.mTableValue.mValues[i]);
+    return length;
+}
+
+} // namespace OldLua
+
+// Returns the total length of the strings.
+static int visit(const LuaCursor &v)
+{
+    int length = 0;
+    if (v.type() == LUA_TSTRING)
+        length = v.toString().length();
+    if (v.isTable()) {
+        LuaTableIterator it(v);
+        while (it.next())
+            length += visit(it.key()) + visit(it.value());
+    }
+    return length;
+}
+
+// An 'events' table shaped like the game's, with 10000 entries.
+static const char *luaTablesSource =
+        "events = {}\n"
+        "for i = 1, 10000 do\n"
+        "    events['Event' .. i] = {\n"
+        "        name = 'Event' .. i,\n"
+        "        inputs = { 'player', 'item', 'square' },\n"
+        "        variables = { { name = 'count', type = 'number', value = i } },\n"
+        "    }\n"
+        "end\n";
+
+static bool benchLuaTables(int iterations)
+{
+    LuaState state(LuaState::SandboxLibraries);
+    if (!state.loadString(QLatin1String(luaTablesSource), QLatin1String("events"))) {
+        fprintf(stderr, "%s\n", qPrintable(state.errorString()));
+        return false;
+    }
+    lua_State *L = state.state();
+
+    QElapsedTimer timer;
+    timer.start();
+    int length = 0;
+    OldLua::allocations = 0;
+    for (int i = 0; i < iterations; i++) {
+        lua_getglobal(L, "events");
+        OldLua::LuaValue v(OldLua::toValue(L, -1));
+        lua_pop(L, 1);
+        length = OldLua::visit(v);
+    }
+    qint64 copyNanoseconds = timer.nsecsElapsed();
+    printf("lua-tables: LuaValue copy    %8.2f ms  %d characters, %d allocations\n",
+           copyNanoseconds / 1000000.0 / iterations, length,
+           OldLua::allocations / iterations);
+
+    timer.restart();
+    for (int i = 0; i < iterations; i++) {
+        LuaStackGuard guard(state);
+        length = visit(state.global("events"));
+    }
+    qint64 cursorNanoseconds = timer.nsecsElapsed();
+    printf("lua-tables: LuaCursor walk   %8.2f ms  %d characters\n",
+           cursorNanoseconds / 1000000.0 / iterations, length);
+
+    return true;
+}
+
+/////
+
+// Highlighter as it was before the single-pass lexer: each rule's QRegExp is
+// run over the whole line.
+class OldHighlighter : public QSyntaxHighlighter
+{
+public:
+    OldHighlighter();
+
+protected:
+    void highlightBlock(const QString &text);
+
+private:
+    struct ParenthesisInfo
+    {
+        char character;
+        int position;
+    };
+
+    class TextBlockData : public QTextBlockUserData
+    {
+    public:
+        ~TextBlockData() { qDeleteAll(m_parentheses); }
+        void insert(ParenthesisInfo *info);
+        QVector<ParenthesisInfo *> m_parentheses;
+    };
+
+    void findMatches(const QString &text, TextBlockData *data, char ch1, char ch2);
+
+    struct HighlightingRule
+    {
+        QRegExp pattern;
+        QTextCharFormat format;
+    };
+    QVector<HighlightingRule> highlightingRules;
+
+    QRegExp commentStartExpression;
+    QRegExp commentEndExpression;
+
+    QTextCharFormat keywordFormat;
+    QTextCharFormat singleLineCommentFormat;
+    QTextCharFormat multiLineCommentFormat;
+    QTextCharFormat quotationFormat;
+    QTextCharFormat functionFormat;
+};
+
+void OldHighlighter::TextBlockData::insert(ParenthesisInfo *info)
+{
+    int i = 0;
+    while (i < m_parentheses.size() &&
+        info->position > m_parentheses.at(i)->position)
+        ++i;
+
+    m_parentheses.insert(i, info);
+}
+
+OldHighlighter::OldHighlighter() :
+    QSyntaxHighlighter(static_cast<QTextDocument*>(0))
+{
+    HighlightingRule rule;
+
+    keywordFormat.setForeground(Qt::darkBlue);
+    keywordFormat.setFontWeight(QFont::Bold);
+    static const char *const keywords[] = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for",
+        "function", "goto", "if", "in", "local", "nil", "not", "or", "repeat",
+        "return", "then", "true", "until", "while", "require", 0
+    };
+    for (const char *const *k = keywords; *k; k++) {
+        rule.pattern = QRegExp(QString(QLatin1String("\\b%1\\b")).arg(QLatin1String(*k)));
+        rule.format = keywordFormat;
+        highlightingRules.append(rule);
+    }
+
+    // Numbers
+    QTextCharFormat numbers;
+    numbers.setForeground(Qt::magenta);
+    rule.pattern = QRegExp(QLatin1String("[0-9]"));
+    rule.format = numbers;
+    highlightingRules.append(rule);
+
+    // Single-line comment
+    singleLineCommentFormat.setForeground(Qt::red);
+    rule.pattern = QRegExp(QLatin1String("--[^\n]*"));
+    rule.format = singleLineCommentFormat;
+    highlightingRules.append(rule);
+
+    // "String"
+    quotationFormat.setForeground(Qt::darkGreen);
+    rule.pattern = QRegExp(QString::fromUtf8("(?:^|[^\\\\'])(\"(?:\\\\\"|\\\\(?!\")|[^\\\\\"^ä^ö^ü])*\")"));
+    rule.pattern.setMinimal(true);
+    rule.format = quotationFormat;
+    highlightingRules.append(rule);
+
+    // 'String'
+    rule.pattern = QRegExp(QLatin1String("(?:^|[^\\\\\"])(\'(?:\\\\\'|\\\\(?!\')|[^\\\\\'])*\')"));
+    rule.pattern.setMinimal(true);
+    rule.format = quotationFormat;
+    highlightingRules.append(rule);
+
+    // Function name()
+    functionFormat.setFontWeight(QFont::Bold);
+    functionFormat.setForeground(Qt::darkCyan);
+    rule.pattern = QRegExp(QLatin1String("\\b[A-Za-z0-9_]+(?=\\()"));
+    rule.format = functionFormat;
+    highlightingRules.append(rule);
+
+    // Multi-line comment --[[ ]]
+    commentStartExpression = QRegExp(QLatin1String("--\\[\\[")); // --[[
+    commentEndExpression = QRegExp(QLatin1String("\\]\\]")); // ]]
+    multiLineCommentFormat.setForeground(Qt::red);
+}
+
+void OldHighlighter::highlightBlock(const QString &text)
+{
+    TextBlockData *data = new TextBlockData;
+    findMatches(text, data, '(', ')');
+    findMatches(text, data, '{', '}');
+    setCurrentBlockUserData(data);
+
+    foreach (const HighlightingRule &rule, highlightingRules) {
+        QRegExp expression(rule.pattern);
+        int index = expression.indexIn(text);
+        while (index >= 0) {
+            int length = expression.matchedLength();
+            setFormat(index, length, rule.format);
+            index = expression.indexIn(text, index + length);
+        }
+    }
+
+    setCurrentBlockState(0);
+    int startIndex = 0;
+    if (previousBlockState() != 1)
+        startIndex = commentStartExpression.indexIn(text);
+
+    while (startIndex >= 0) {
+        int endIndex = commentEndExpression.indexIn(text, startIndex);
+        int commentLength;
+        if (endIndex == -1) {
+            setCurrentBlockState(1);
+            commentLength = text.length() - startIndex;
+        } else {
+            commentLength = endIndex - startIndex
+                    + commentEndExpression.matchedLength();
+        }
+        setFormat(startIndex, commentLength, multiLineCommentFormat);
+        startIndex = commentStartExpression.indexIn(text, startIndex + commentLength);
+    }
+}
+
+void OldHighlighter::findMatches(const QString &text, TextBlockData *data, char ch1, char ch2)
+{
+    int leftPos = text.indexOf(QLatin1Char(ch1));
+    while (leftPos != -1) {
+        ParenthesisInfo *info = new ParenthesisInfo;
+        info->character = ch1;
+        info->position = leftPos;
+        data->insert(info);
+        leftPos = text.indexOf(QLatin1Char(ch1), leftPos + 1);
+    }
+
+    int rightPos = text.indexOf(QLatin1Char(ch2));
+    while (rightPos != -1) {
+        ParenthesisInfo *info = new ParenthesisInfo;
+        info->character = ch2;
+        info->position = rightPos;
+        data->insert(info);
+        rightPos = text.indexOf(QLatin1Char(ch2), rightPos + 1);
+    }
+}
+
+// A Lua file of 'lines' lines in the style of the game's scripts.
+static QString luaSource(int lines)
+{
+    static const char *const chunk[] = {
+        "--[[ Handles the player picking up an item.",
+        "     Called from OnFillInventoryObjectContextMenu. ]]",
+        "function ISInventoryMenu.onPickup(player, items, count)",
+        "    local inv = getSpecificPlayer(player):getInventory() -- the main container",
+        "    for i = 1, #items do",
+        "        local item = items[i]",
+        "        if item ~= nil and item:getType() == \"Base.Axe\" then",
+        "            inv:AddItem(item, { weight = 1.5, name = 'axe' })",
+        "        elseif count > 10 then",
+        "            print(\"too many items: \" .. tostring(count))",
+        "        end",
+        "    end",
+        "    return true",
+        "end",
+        "",
+        0
+    };
+    QString text;
+    int i = 0;
+    for (int line = 0; line < lines; line++) {
+        if (!chunk[i])
+            i = 0;
+        text += QLatin1String(chunk[i++]);
+        text += QLatin1Char('\n');
+    }
+    return text;
+}
+
+// Times highlighting a whole document and then typing a character on each of
+// 'edits' lines, each of which highlights that line again.
+static void benchHighlighter(const char *label, QSyntaxHighlighter &highlighter,
+                             const QString &text, int edits, int iterations)
+{
+    qint64 allNanoseconds = 0, editNanoseconds = 0;
+    for (int i = 0; i < iterations; i++) {
+        QTextDocument document;
+        document.setPlainText(text);
+
+        // LuaEditor looks up brackets whenever the cursor moves.
+        Highlighter *lexer = dynamic_cast<Highlighter*>(&highlighter);
+
+        QElapsedTimer timer;
+        timer.start();
+        highlighter.setDocument(&document);
+        highlighter.rehighlight();
+        if (lexer)
+            lexer->bracketIndex();
+        allNanoseconds += timer.nsecsElapsed();
+
+        int blockCount = document.blockCount();
+        timer.restart();
+        for (int j = 0; j < edits; j++) {
+            QTextCursor cursor(document.findBlockByNumber(j * blockCount / edits));
+            cursor.movePosition(QTextCursor::EndOfBlock);
+            cursor.insertText(QLatin1String(" "));
+            if (lexer)
+                lexer->bracketIndex();
+        }
+        editNanoseconds += timer.nsecsElapsed();
+
+        highlighter.setDocument(0);
+    }
+    printf("highlighter: %-14s %8.2f ms whole file, %6.3f ms per edit\n", label,
+           allNanoseconds / 1000000.0 / iterations,
+           editNanoseconds / 1000000.0 / iterations / edits);
+}
+
+static bool benchHighlighters(int iterations)
+{
+    QString text = luaSource(20000);
+    int edits = 200;
+
+    OldHighlighter oldHighlighter;
+    benchHighlighter("QRegExp rules", oldHighlighter, text, edits, iterations);
+
+    Highlighter highlighter;
+    benchHighlighter("lexer", highlighter, text, edits, iterations);
+
+    return true;
+}
+
+/////
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: scripted-bench [--iterations N] [benchmark...]\n"
+            "\n"
+            "Benchmarks:\n"
+            "  lua-tables    read a 10000-entry Lua table by copying it into\n"
+            "                LuaValues and by walking it with LuaCursor\n"
+            "  highlighter   highlight a 20000-line Lua file and edit 200 lines of\n"
+            "                it with the old QRegExp rules and with the lexer\n"
+            "\n"
+            "All benchmarks are run if none are given.  Times are per iteration.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    // QTextDocument needs a QApplication for its fonts, but nothing is shown.
+#if QT_VERSION >= 0x050000
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication a(argc, argv);
+#else
+    QApplication a(argc, argv, false);
+#endif
+
+    int iterations = 10;
+    QStringList benchmarks;
+    QStringList args = a.arguments().mid(1);
+    for (int i = 0; i < args.size(); i++) {
+        if (args[i] == QLatin1String("--iterations") && i + 1 < args.size())
+            iterations = qMax(args[++i].toInt(), 1);
+        else if (args[i] == QLatin1String("lua-tables") ||
+                 args[i] == QLatin1String("highlighter"))
+            benchmarks += args[i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (benchmarks.isEmpty())
+        benchmarks << QLatin1String("lua-tables") << QLatin1String("highlighter");
+
+    bool ok = true;
+    foreach (const QString &benchmark, benchmarks) {
+        if (benchmark == QLatin1String("lua-tables"))
+            ok = benchLuaTables(iterations) && ok;
+        else if (benchmark == QLatin1String("highlighter"))
+            ok = benchHighlighters(iterations) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -24,6 +24,7 @@
 
 class BaseGraphicsScene : public QGraphicsScene
 {
+    Q_OBJECT
 public:
     enum SceneType {
         CellSceneType,
@@ -42,6 +43,12 @@ public:
 
     void clearScene();
 
+signals:
+    // Emitted by subclasses after something they draw changed, for views
+    // that keep their own picture of the scene like the MiniMap.  A null
+    // rect means anywhere in the scene.
+    void contentsChanged(const QRectF &rect);
+
 protected:
     BaseGraphicsView *mEventView;
     SceneType mType;
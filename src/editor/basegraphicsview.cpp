@@ -56,7 +56,10 @@ BaseGraphicsView::BaseGraphicsView(AllowOpenGL openGL, QWidget *parent)
     mScrollTimer.setInterval(30);
     connect(&mScrollTimer, SIGNAL(timeout()), SLOT(autoScrollTimeout()));
 
-//    mMiniMap = new MiniMap(this);
+    // The MiniMap is only created once it is wanted, after that it hides
+    // itself when the preference is turned off.
+    setShowMiniMap(prefs()->showMiniMap());
+    connect(prefs(), SIGNAL(showMiniMapChanged(bool)), SLOT(setShowMiniMap(bool)));
 
 #ifndef QT_NO_OPENGL
     if (openGL == PreferenceGL) {
@@ -119,6 +122,15 @@ void BaseGraphicsView::setUseOpenGL(bool useOpenGL)
 #endif
 }
 
+void BaseGraphicsView::setShowMiniMap(bool show)
+{
+    if (!show || mMiniMap)
+        return;
+    mMiniMap = new MiniMap(this);
+    if (mScene)
+        mMiniMap->setScene(mScene);
+}
+
 void BaseGraphicsView::autoScrollTimeout()
 {
     if(mScrollDirection & ScrollLeft) {
@@ -317,17 +329,19 @@ void BaseGraphicsView::scrollContentsBy(int dx, int dy)
 
 void BaseGraphicsView::addMiniMapItem(QGraphicsItem *item)
 {
-    mMiniMap->addItem(item);
+    if (mMiniMap)
+        mMiniMap->addItem(item);
 }
 
 void BaseGraphicsView::removeMiniMapItem(QGraphicsItem *item)
 {
-    mMiniMap->removeItem(item);
+    if (mMiniMap)
+        mMiniMap->removeItem(item);
 }
 
 QRectF BaseGraphicsView::sceneRectForMiniMap() const
 {
-    return mScene->sceneRect();
+    return mScene ? mScene->sceneRect() : QRectF();
 }
 
 // Wrapper around QGraphicsView::ensureVisible.  In ensureVisible, when the rectangle to
@@ -355,16 +369,26 @@ void BaseGraphicsView::ensureRectVisible(const QRectF &rect, int xmargin, int ym
 
 #include <QGraphicsPolygonItem>
 #include <QHBoxLayout>
+#include <QPainter>
 #include <QToolButton>
+#include <QtMath>
 #include <cmath>
 
+// Size of a thumbnail tile in MiniMap pixels.
+#define MINIMAP_TILE_SIZE 64
+// Tiles rendered before going back to the event loop.
+#define MINIMAP_TILES_PER_UPDATE 4
+
 MiniMap::MiniMap(BaseGraphicsView *parent)
     : QGraphicsView(parent)
     , mParentView(parent)
+    , mScene(0)
     , mViewportItem(0)
     , mButtons(new QFrame(this))
     , mBiggerButton(new QToolButton(mButtons))
     , mSmallerButton(new QToolButton(mButtons))
+    , mTileColumns(0)
+    , mTileRows(0)
 {
     setFrameStyle(NoFrame);
 
@@ -425,6 +449,9 @@ MiniMap::MiniMap(BaseGraphicsView *parent)
     layout->addWidget(button);
 #endif
 
+    mThumbnailTimer.setSingleShot(true);
+    connect(&mThumbnailTimer, SIGNAL(timeout()), SLOT(updateThumbnail()));
+
     setGeometry(20, 20, 220, 220);
 
     // When visible, the MiniMap obscures part of the scene, slowing down scrolling. :-{
@@ -433,9 +460,12 @@ MiniMap::MiniMap(BaseGraphicsView *parent)
 
 void MiniMap::setScene(BaseGraphicsScene *scene)
 {
+    if (mScene)
+        mScene->disconnect(this);
     mScene = scene;
     widthChanged(mWidth);
     connect(mScene, SIGNAL(sceneRectChanged(QRectF)), SLOT(sceneRectChanged(QRectF)));
+    connect(mScene, SIGNAL(contentsChanged(QRectF)), SLOT(sceneContentsChanged(QRectF)));
 }
 
 void MiniMap::viewRectChanged()
@@ -484,6 +514,8 @@ void MiniMap::sceneRectChanged(const QRectF &_sceneRect)
 
     foreach (QGraphicsItem *item, mExtraItems)
         item->setScale(scale);
+
+    resetThumbnail();
 }
 
 void MiniMap::bigger()
@@ -499,7 +531,8 @@ void MiniMap::smaller()
 void MiniMap::widthChanged(int width)
 {
     mWidth = width;
-    sceneRectChanged(mScene->sceneRect());
+    if (mScene)
+        sceneRectChanged(mScene->sceneRect());
 
     mSmallerButton->setEnabled(mWidth > MINIMAP_WIDTH_MIN);
     mBiggerButton->setEnabled(mWidth < MINIMAP_WIDTH_MAX);
@@ -520,6 +553,121 @@ bool MiniMap::event(QEvent *event)
     return QGraphicsView::event(event);
 }
 
+// Tiles aren't rendered while hidden.
+void MiniMap::showEvent(QShowEvent *event)
+{
+    QGraphicsView::showEvent(event);
+    if (mDirtyTiles.contains(true))
+        startThumbnailTimer(0);
+}
+
+void MiniMap::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsView::drawBackground(painter, rect);
+
+    for (int row = 0; row < mTileRows; row++) {
+        for (int column = 0; column < mTileColumns; column++) {
+            const QImage &image = mTiles[row * mTileColumns + column];
+            QRectF r = tileRect(column, row);
+            if (!image.isNull() && r.intersects(rect))
+                painter->drawImage(r.topLeft(), image);
+        }
+    }
+}
+
+// Throws away the thumbnail after the scale or scene rect changed.
+void MiniMap::resetThumbnail()
+{
+    QSizeF size = scene()->sceneRect().size();
+    mTileColumns = qCeil(size.width() / MINIMAP_TILE_SIZE);
+    mTileRows = qCeil(size.height() / MINIMAP_TILE_SIZE);
+    mTiles = QVector<QImage>(mTileColumns * mTileRows);
+    mDirtyTiles = QVector<bool>(mTileColumns * mTileRows, true);
+    startThumbnailTimer(0);
+}
+
+void MiniMap::startThumbnailTimer(int interval)
+{
+    if (mThumbnailTimer.isActive())
+        return;
+    // Don't compete with dragging in the parent view.
+    if (QApplication::mouseButtons() != Qt::NoButton)
+        interval = qMax(interval, 1000);
+    mThumbnailTimer.start(interval);
+}
+
+QRectF MiniMap::tileRect(int column, int row)
+{
+    return QRectF(scene()->sceneRect().topLeft() + QPointF(column, row) * MINIMAP_TILE_SIZE,
+                  QSizeF(MINIMAP_TILE_SIZE, MINIMAP_TILE_SIZE));
+}
+
+void MiniMap::sceneContentsChanged(const QRectF &sceneRect)
+{
+    if (!mScene || mTiles.isEmpty())
+        return;
+
+    if (sceneRect.isNull()) {
+        mDirtyTiles.fill(true);
+        startThumbnailTimer(250);
+        return;
+    }
+
+    qreal scale = this->scale();
+    QPointF origin = scene()->sceneRect().topLeft();
+    QRectF r(sceneRect.topLeft() * scale - origin, sceneRect.size() * scale);
+    int left = qMax(0, qFloor(r.left() / MINIMAP_TILE_SIZE));
+    int top = qMax(0, qFloor(r.top() / MINIMAP_TILE_SIZE));
+    int right = qMin(mTileColumns - 1, qFloor(r.right() / MINIMAP_TILE_SIZE));
+    int bottom = qMin(mTileRows - 1, qFloor(r.bottom() / MINIMAP_TILE_SIZE));
+    bool dirty = false;
+    for (int row = top; row <= bottom; row++) {
+        for (int column = left; column <= right; column++) {
+            mDirtyTiles[row * mTileColumns + column] = true;
+            dirty = true;
+        }
+    }
+
+    if (dirty)
+        startThumbnailTimer(250);
+}
+
+// Re-renders some of the out-of-date tiles, and schedules itself again if
+// there are more.
+void MiniMap::updateThumbnail()
+{
+    if (!mScene || !isVisible())
+        return;
+
+    if (QApplication::mouseButtons() != Qt::NoButton) {
+        startThumbnailTimer(1000);
+        return;
+    }
+
+    qreal scale = this->scale();
+    int rendered = 0;
+    for (int i = 0; i < mTiles.size(); i++) {
+        if (!mDirtyTiles[i])
+            continue;
+        if (rendered == MINIMAP_TILES_PER_UPDATE) {
+            startThumbnailTimer(0);
+            break;
+        }
+        QRectF r = tileRect(i % mTileColumns, i / mTileColumns);
+        QImage image(MINIMAP_TILE_SIZE, MINIMAP_TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        image.fill(0);
+        QPainter painter(&image);
+        mScene->render(&painter, QRectF(QPointF(), r.size()),
+                       QRectF(r.topLeft() / scale, r.size() / scale),
+                       Qt::IgnoreAspectRatio);
+        painter.end();
+        mTiles[i] = image;
+        mDirtyTiles[i] = false;
+        viewport()->update(mapFromScene(r).boundingRect());
+        ++rendered;
+    }
+}
+
 void MiniMap::mousePressEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton)
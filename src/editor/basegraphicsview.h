@@ -19,7 +19,9 @@
 #define BASEGRAPHICSVIEW_H
 
 #include <QGraphicsView>
+#include <QImage>
 #include <QTimer>
+#include <QVector>
 
 class BaseGraphicsScene;
 class BaseGraphicsView;
@@ -45,8 +47,17 @@ public slots:
     void smaller();
     void widthChanged(int width);
 
+private slots:
+    void sceneContentsChanged(const QRectF &sceneRect);
+    void updateThumbnail();
+
 private:
     bool event(QEvent *event);
+    void showEvent(QShowEvent *event);
+    void drawBackground(QPainter *painter, const QRectF &rect);
+    void resetThumbnail();
+    void startThumbnailTimer(int interval);
+    QRectF tileRect(int column, int row);
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
@@ -60,6 +71,17 @@ private:
     QToolButton *mBiggerButton;
     QToolButton *mSmallerButton;
     int mWidth;
+
+    // The scene is drawn from a thumbnail made of tiles, in MiniMap scene
+    // coordinates.  Tiles are re-rendered a few at a time after the scene
+    // reports a change with contentsChanged().  The scene's changed() signal
+    // isn't used, connecting to it makes every view of the scene repaint
+    // through it instead of directly.
+    int mTileColumns;
+    int mTileRows;
+    QVector<QImage> mTiles;
+    QVector<bool> mDirtyTiles;
+    QTimer mThumbnailTimer;
 };
 
 class BaseGraphicsView : public QGraphicsView
@@ -107,6 +129,7 @@ public slots:
 
 private slots:
     void setUseOpenGL(bool useOpenGL);
+    void setShowMiniMap(bool show);
 
 protected:
     bool mHandScrolling;
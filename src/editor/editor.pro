@@ -63,7 +63,11 @@ SOURCES += main.cpp\
     connectionsdialog.cpp \
     luadocument.cpp \
     luaeditor.cpp \
-    luamode.cpp
+    luamode.cpp \
+    luacache.cpp \
+    luafileloader.cpp \
+    symboltable.cpp \
+    projectloader.cpp
 
 HEADERS  += mainwindow.h \
     scriptscene.h \
@@ -120,7 +124,12 @@ HEADERS  += mainwindow.h \
     connectionsdialog.h \
     luadocument.h \
     luaeditor.h \
-    luamode.h
+    luamode.h \
+    luacache.h \
+    luafileloader.h \
+    projectbinary.h \
+    symboltable.h \
+    projectloader.h
 
 FORMS    += mainwindow.ui \
     welcomemode.ui \
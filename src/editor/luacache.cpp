@@ -0,0 +1,230 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luacache.h"
+
+#include "node.h"
+#include "scriptvariable.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#define LUACACHE_MAGIC 0x4C554143 // LUAC
+#define LUACACHE_VERSION 1
+
+QDataStream &operator<<(QDataStream &out, const LuaCacheEntry::Port &port)
+{
+    out << port.mName << port.mLabel;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, LuaCacheEntry::Port &port)
+{
+    in >> port.mName >> port.mLabel;
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const LuaCacheEntry::Variable &var)
+{
+    out << var.mType << var.mName << var.mLabel << var.mValue;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, LuaCacheEntry::Variable &var)
+{
+    in >> var.mType >> var.mName >> var.mLabel >> var.mValue;
+    return in;
+}
+
+/////
+
+bool LuaCacheEntry::hasInput(const QString &name) const
+{
+    foreach (const Port &port, mInputs)
+        if (port.mName == name)
+            return true;
+    return false;
+}
+
+bool LuaCacheEntry::hasOutput(const QString &name) const
+{
+    foreach (const Port &port, mOutputs)
+        if (port.mName == name)
+            return true;
+    return false;
+}
+
+bool LuaCacheEntry::hasVariable(const QString &name) const
+{
+    foreach (const Variable &var, mVariables)
+        if (var.mName == name)
+            return true;
+    return false;
+}
+
+LuaNode *LuaCacheEntry::toNode() const
+{
+    LuaNode *node = new LuaNode(0, QFileInfo(mPath).baseName());
+    foreach (const Port &port, mInputs)
+        node->insertInput(node->inputCount(), new NodeInput(port.mName, port.mLabel));
+    foreach (const Port &port, mOutputs)
+        node->insertOutput(node->outputCount(), new NodeOutput(port.mName, port.mLabel));
+    foreach (const Variable &var, mVariables)
+        node->insertVariable(node->variableCount(),
+                             new ScriptVariable(var.mType, var.mName, var.mLabel, var.mValue));
+    return node;
+}
+
+/////
+
+LuaCache::LuaCache() :
+    mDirty(false)
+{
+}
+
+LuaCache::~LuaCache()
+{
+    qDeleteAll(mEntries);
+}
+
+bool LuaCache::read(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.exists())
+        return true; // nothing cached yet
+    if (!file.open(QFile::ReadOnly)) {
+        mError = QCoreApplication::translate("LuaCache", "Unable to read file: %1")
+                .arg(fileName);
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_8);
+
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != LUACACHE_MAGIC || version != LUACACHE_VERSION) {
+        // Old or foreign file, it will be replaced by the next write().
+        mDirty = true;
+        return true;
+    }
+
+    qint32 count;
+    in >> count;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        LuaCacheEntry *entry = new LuaCacheEntry;
+        in >> entry->mPath >> entry->mLastModified >> entry->mSize >> entry->mHash;
+        in >> entry->mInputs >> entry->mOutputs >> entry->mVariables;
+        if (in.status() != QDataStream::Ok) {
+            delete entry;
+            break;
+        }
+        delete mEntries.take(entry->mPath);
+        mEntries[entry->mPath] = entry;
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        mError = QCoreApplication::translate("LuaCache", "Corrupt cache file: %1")
+                .arg(fileName);
+        qDeleteAll(mEntries);
+        mEntries.clear();
+        mDirty = true;
+        return false;
+    }
+
+    mDirty = false;
+    return true;
+}
+
+bool LuaCache::write(const QString &fileName)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        mError = QCoreApplication::translate("LuaCache", "Could not open file for writing: %1")
+                .arg(fileName);
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_8);
+
+    out << quint32(LUACACHE_MAGIC) << quint32(LUACACHE_VERSION);
+    out << qint32(mEntries.size());
+    foreach (LuaCacheEntry *entry, mEntries) {
+        out << entry->mPath << entry->mLastModified << entry->mSize << entry->mHash;
+        out << entry->mInputs << entry->mOutputs << entry->mVariables;
+    }
+
+    if (file.error() != QFile::NoError) {
+        mError = file.errorString();
+        return false;
+    }
+
+    mDirty = false;
+    return true;
+}
+
+const LuaCacheEntry *LuaCache::entry(const QFileInfo &fileInfo)
+{
+    QString path = fileInfo.canonicalFilePath();
+    if (!mEntries.contains(path))
+        return 0;
+
+    LuaCacheEntry *entry = mEntries[path];
+    qint64 lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    if (entry->mLastModified == lastModified && entry->mSize == fileInfo.size())
+        return entry;
+
+    // The timestamp changed, see if the contents did too.
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+    if (hash(file.readAll()) != entry->mHash)
+        return 0;
+
+    entry->mLastModified = lastModified;
+    entry->mSize = fileInfo.size();
+    mDirty = true;
+    return entry;
+}
+
+void LuaCache::insert(const LuaCacheEntry &entry)
+{
+    delete mEntries.take(entry.mPath);
+    mEntries[entry.mPath] = new LuaCacheEntry(entry);
+    mDirty = true;
+}
+
+void LuaCache::remove(const QString &path)
+{
+    if (mEntries.contains(path)) {
+        delete mEntries.take(path);
+        mDirty = true;
+    }
+}
+
+QByteArray LuaCache::hash(const QByteArray &contents)
+{
+    return QCryptographicHash::hash(contents, QCryptographicHash::Md5);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LUACACHE_H
+#define LUACACHE_H
+
+#include "editor_global.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+class QFileInfo;
+
+// The inputs, outputs and variables extracted from the 'editor' table of a
+// command .lua file.  This is plain data so it can be written to disk and
+// created without touching any of the node classes.
+class LuaCacheEntry
+{
+public:
+    class Port
+    {
+    public:
+        QString mName;
+        QString mLabel;
+    };
+
+    class Variable
+    {
+    public:
+        QString mType;
+        QString mName;
+        QString mLabel;
+        QString mValue;
+    };
+
+    LuaCacheEntry() :
+        mLastModified(0),
+        mSize(0)
+    {
+    }
+
+    bool hasInput(const QString &name) const;
+    bool hasOutput(const QString &name) const;
+    bool hasVariable(const QString &name) const;
+
+    LuaNode *toNode() const;
+
+    QString mPath; // canonical path of the .lua file
+    qint64 mLastModified; // msecs since epoch
+    qint64 mSize;
+    QByteArray mHash; // of the file contents
+    QList<Port> mInputs;
+    QList<Port> mOutputs;
+    QList<Variable> mVariables;
+};
+
+// A persistent cache of LuaCacheEntry keyed by canonical path.  An entry is
+// valid when the file's modification time and size are unchanged, or, failing
+// that, when the hash of the file contents is unchanged (the file was only
+// touched or copied).
+class LuaCache
+{
+public:
+    LuaCache();
+    ~LuaCache();
+
+    bool read(const QString &fileName);
+    bool write(const QString &fileName);
+
+    const LuaCacheEntry *entry(const QFileInfo &fileInfo);
+    void insert(const LuaCacheEntry &entry);
+    void remove(const QString &path);
+
+    QList<QString> paths() const
+    { return mEntries.keys(); }
+
+    bool isDirty() const
+    { return mDirty; }
+
+    QString errorString() const
+    { return mError; }
+
+    static QByteArray hash(const QByteArray &contents);
+
+private:
+    QMap<QString,LuaCacheEntry*> mEntries;
+    bool mDirty;
+    QString mError;
+};
+
+#endif // LUACACHE_H
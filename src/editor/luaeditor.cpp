@@ -18,161 +18,500 @@
 #include "luaeditor.h"
 
 #include "editor_global.h"
+#include "luautils.h"
 
 #include <QApplication>
+#include <QMutexLocker>
 #include <QPainter>
+#include <QRunnable>
+#include <QTextBlock>
+#include <QTextDocument>
 
 TextBlockData::TextBlockData()
 {
     // Nothing to do
 }
 
-QVector<ParenthesisInfo *> TextBlockData::parentheses()
+void TextBlockData::append(const ParenthesisInfo &info)
 {
-    return m_parentheses;
+    Q_ASSERT(m_parentheses.isEmpty() || m_parentheses.last().position < info.position);
+    m_parentheses += info;
 }
 
-void TextBlockData::insert(ParenthesisInfo *info)
+/////
+
+// The pairs of characters each kind of bracket in BracketIndex is made of.
+static const char *const BRACKET_KINDS[] = {
+    "()", "{}", "[]", "BE", "RU"
+};
+
+BracketIndex::BracketIndex() :
+    mSize(0),
+    mCapacity(0)
 {
-    int i = 0;
-    while (i < m_parentheses.size() &&
-        info->position > m_parentheses.at(i)->position)
-        ++i;
+}
+
+int BracketIndex::kindOf(char open, char close)
+{
+    for (int kind = 0; kind < KindCount; kind++)
+        if (BRACKET_KINDS[kind][0] == open && BRACKET_KINDS[kind][1] == close)
+            return kind;
+    return -1;
+}
+
+void BracketIndex::rebuild(QTextDocument *document)
+{
+    mSize = document->blockCount();
+    mCapacity = 1;
+    while (mCapacity < mSize)
+        mCapacity *= 2;
+
+    Node empty = { 0, 0, 0 };
+    for (int kind = 0; kind < KindCount; kind++)
+        mNodes[kind].fill(empty, mCapacity * 2);
+
+    int blockNumber = 0;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        if (const TextBlockData *data = static_cast<TextBlockData*>(block.userData()))
+            for (int kind = 0; kind < KindCount; kind++)
+                setLeaf(kind, blockNumber, data);
+        ++blockNumber;
+    }
+
+    for (int kind = 0; kind < KindCount; kind++)
+        for (int node = mCapacity - 1; node >= 1; node--)
+            combine(kind, node);
+}
+
+void BracketIndex::setBlock(int blockNumber, const TextBlockData *data)
+{
+    if (blockNumber < 0 || blockNumber >= mSize)
+        return;
+    for (int kind = 0; kind < KindCount; kind++) {
+        setLeaf(kind, blockNumber, data);
+        for (int node = (mCapacity + blockNumber) / 2; node >= 1; node /= 2)
+            combine(kind, node);
+    }
+}
+
+void BracketIndex::insertBlocks(int blockNumber, int count)
+{
+    if (count <= 0 || blockNumber < 0 || blockNumber > mSize)
+        return;
+    moveLeaves(blockNumber, count);
+}
 
-    m_parentheses.insert(i, info);
+void BracketIndex::removeBlocks(int blockNumber, int count)
+{
+    if (count <= 0 || blockNumber < 0 || blockNumber + count > mSize)
+        return;
+    moveLeaves(blockNumber + count, -count);
+}
+
+// Moves the leaves from blockNumber on by 'count', which is negative when
+// blocks were removed, and recombines only the nodes above the moved leaves.
+void BracketIndex::moveLeaves(int blockNumber, int count)
+{
+    int size = mSize + count;
+    int capacity = qMax(mCapacity, 1);
+    while (capacity < size)
+        capacity *= 2;
+
+    Node empty = { 0, 0, 0 };
+    for (int kind = 0; kind < KindCount; kind++) {
+        QVector<Node> &nodes = mNodes[kind];
+        int first = blockNumber + qMin(count, 0);
+        int last = qMax(size, mSize) - 1;
+        if (capacity != mCapacity) {
+            QVector<Node> grown(capacity * 2, empty);
+            for (int i = 0; i < mSize; i++)
+                grown[capacity + i] = nodes[mCapacity + i];
+            nodes = grown;
+            first = 0;
+            last = capacity - 1;
+        }
+
+        Node *leaves = nodes.data() + capacity;
+        if (count > 0) {
+            for (int i = mSize - 1; i >= blockNumber; i--)
+                leaves[i + count] = leaves[i];
+            for (int i = blockNumber; i < blockNumber + count; i++)
+                leaves[i] = empty;
+        } else {
+            for (int i = blockNumber; i < mSize; i++)
+                leaves[i + count] = leaves[i];
+            for (int i = size; i < mSize; i++)
+                leaves[i] = empty;
+        }
+
+        for (int lo = capacity + first, hi = capacity + last; lo > 1; ) {
+            lo /= 2;
+            hi /= 2;
+            for (int node = lo; node <= hi; node++)
+                combine(kind, node);
+        }
+    }
+
+    mSize = size;
+    mCapacity = capacity;
+}
+
+void BracketIndex::setLeaf(int kind, int blockNumber, const TextBlockData *data)
+{
+    char open = BRACKET_KINDS[kind][0], close = BRACKET_KINDS[kind][1];
+    const QVector<ParenthesisInfo> &infos = data->parentheses();
+
+    Node &leaf = mNodes[kind][mCapacity + blockNumber];
+    leaf.mDelta = leaf.mMinForward = leaf.mMinBackward = 0;
+    for (int i = 0; i < infos.size(); i++) {
+        if (infos[i].character == open)
+            ++leaf.mDelta;
+        else if (infos[i].character == close)
+            leaf.mMinForward = qMin(leaf.mMinForward, --leaf.mDelta);
+    }
+    int depth = 0;
+    for (int i = infos.size() - 1; i >= 0; i--) {
+        if (infos[i].character == close)
+            ++depth;
+        else if (infos[i].character == open)
+            leaf.mMinBackward = qMin(leaf.mMinBackward, --depth);
+    }
+}
+
+void BracketIndex::combine(int kind, int node)
+{
+    const Node &left = mNodes[kind][node * 2];
+    const Node &right = mNodes[kind][node * 2 + 1];
+    Node &n = mNodes[kind][node];
+    n.mDelta = left.mDelta + right.mDelta;
+    n.mMinForward = qMin(left.mMinForward, left.mDelta + right.mMinForward);
+    n.mMinBackward = qMin(right.mMinBackward, left.mMinBackward - right.mDelta);
+}
+
+int BracketIndex::findClose(char open, char close, int blockNumber, int &depth) const
+{
+    int kind = kindOf(open, close);
+    if (kind == -1 || mSize == 0)
+        return -1;
+    return findForward(kind, 1, 0, mCapacity - 1, blockNumber + 1, depth);
+}
+
+int BracketIndex::findOpen(char open, char close, int blockNumber, int &depth) const
+{
+    int kind = kindOf(open, close);
+    if (kind == -1 || mSize == 0)
+        return -1;
+    return findBackward(kind, 1, 0, mCapacity - 1, blockNumber - 1, depth);
+}
+
+// The node covers blocks first to last.  Nodes entirely before 'from' are
+// skipped, nodes that can't bring the depth to 0 are stepped over.
+int BracketIndex::findForward(int kind, int node, int first, int last, int from, int &depth) const
+{
+    if (last < from)
+        return -1;
+    const Node &n = mNodes[kind][node];
+    if (first >= from && depth + n.mMinForward > 0) {
+        depth += n.mDelta;
+        return -1;
+    }
+    if (first == last)
+        return first;
+    int middle = (first + last) / 2;
+    int found = findForward(kind, node * 2, first, middle, from, depth);
+    if (found == -1)
+        found = findForward(kind, node * 2 + 1, middle + 1, last, from, depth);
+    return found;
+}
+
+int BracketIndex::findBackward(int kind, int node, int first, int last, int to, int &depth) const
+{
+    if (first > to)
+        return -1;
+    const Node &n = mNodes[kind][node];
+    if (last <= to && depth + n.mMinBackward > 0) {
+        depth -= n.mDelta;
+        return -1;
+    }
+    if (first == last)
+        return first;
+    int middle = (first + last) / 2;
+    int found = findBackward(kind, node * 2 + 1, middle + 1, last, to, depth);
+    if (found == -1)
+        found = findBackward(kind, node * 2, first, middle, to, depth);
+    return found;
 }
 
 /////
 
 Highlighter::Highlighter(QTextDocument *parent) :
-    QSyntaxHighlighter(parent)
+    QSyntaxHighlighter(static_cast<QObject*>(parent)),
+    mBracketIndexDirty(true)
 {
-    HighlightingRule rule;
-
     keywordFormat.setForeground(Qt::darkBlue);
     keywordFormat.setFontWeight(QFont::Bold);
-    QStringList keywordPatterns;
-    keywordPatterns << "\\band\\b" << "\\bbreak\\b" << "\\bdo\\b"
-                    << "\\belse\\b" << "\\belseif\\b" << "\\bend\\b"
-                    << "\\bfalse\\b" << "\\bfor\\b" << "\\bfunction\\b"
-                    << "\\bgoto\\b" << "\\bif\\b" << "\\bin\\b"
-                    << "\\blocal\\b" << "\\bnil\\b" << "\\bnot\\b"
-                    << "\\bor\\b" << "\\brepeat\\b" << "\\breturn\\b"
-                    << "\\bthen\\b" << "\\btrue\\b" << "\\buntil\\b"
-                    << "\\bwhile\\b" << "\\brequire\\b";
-    foreach (const QString &pattern, keywordPatterns) {
-        rule.pattern = QRegExp(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
-    }
 
-    // Numbers
-    QTextCharFormat numbers;
-    numbers.setForeground(Qt::magenta);
-    rule.pattern = QRegExp("[0-9]");
-    rule.format = numbers;
-    highlightingRules.append(rule);
+    numberFormat.setForeground(Qt::magenta);
 
-    // Single-line comment
     singleLineCommentFormat.setForeground(Qt::red);
-    rule.pattern = QRegExp("--[^\n]*");
-    rule.format = singleLineCommentFormat;
-    highlightingRules.append(rule);
-
-    // "String"
-    quotationFormat.setForeground(Qt::darkGreen);
-    rule.pattern = QRegExp("\".*\"");
-    rule.pattern = QRegExp( "(?:^|[^\\\\'])(\"(?:\\\\\"|\\\\(?!\")|[^\\\\\"^ä^ö^ü])*\")" );
-    rule.pattern.setMinimal(true);
-    rule.format = quotationFormat;
-    highlightingRules.append(rule);
+    multiLineCommentFormat.setForeground(Qt::red);
 
-    // 'String'
     quotationFormat.setForeground(Qt::darkGreen);
-    rule.pattern = QRegExp("\'.*\'");
-    rule.pattern = QRegExp( "(?:^|[^\\\\\"])(\'(?:\\\\\'|\\\\(?!\')|[^\\\\\'])*\')" );
-    rule.pattern.setMinimal(true);
-    rule.format = quotationFormat;
-    highlightingRules.append(rule);
 
     // Function name()
     functionFormat.setFontWeight(QFont::Bold);
     functionFormat.setForeground(Qt::darkCyan);
-    rule.pattern = QRegExp("\\b[A-Za-z0-9_]+(?=\\()");
-    rule.format = functionFormat;
-    highlightingRules.append(rule);
 
-    // Multi-line comment --[[ ]]
-    commentStartExpression = QRegExp("--\\[\\["); // --[[
-    commentEndExpression = QRegExp("\\]\\]"); // ]]
-    multiLineCommentFormat.setForeground(Qt::red);
+    // Connected before QSyntaxHighlighter connects to the same signal, so the
+    // index has the right number of blocks before they are highlighted.
+    if (parent) {
+        connect(parent, SIGNAL(contentsChange(int,int,int)),
+                SLOT(documentContentsChange(int,int,int)));
+        setDocument(parent);
+    }
+}
+
+static bool isIdentifierStart(ushort c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool isDigit(ushort c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool isIdentifierChar(ushort c)
+{
+    return isIdentifierStart(c) || isDigit(c);
+}
+
+static bool isWord(const QChar *s, int length, const char *word)
+{
+    int i = 0;
+    while (i < length && word[i] && s[i].unicode() == ushort(word[i]))
+        ++i;
+    return i == length && !word[i];
+}
+
+static bool isKeyword(const QChar *s, int length)
+{
+    static const char *const keywords[] = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for",
+        "function", "goto", "if", "in", "local", "nil", "not", "or", "repeat",
+        "return", "then", "true", "until", "while", "require", 0
+    };
+    for (const char *const *k = keywords; *k; k++)
+        if (isWord(s, length, *k))
+            return true;
+    return false;
+}
+
+// The ParenthesisInfo character for keywords that open or close a block, or 0.
+// 'while' and 'for' blocks are opened by their 'do'.
+static char blockKeyword(const QChar *s, int length)
+{
+    if (isWord(s, length, "function") || isWord(s, length, "do") || isWord(s, length, "if"))
+        return BLOCK_OPEN;
+    if (isWord(s, length, "end"))
+        return BLOCK_CLOSE;
+    if (isWord(s, length, "repeat"))
+        return REPEAT_OPEN;
+    if (isWord(s, length, "until"))
+        return REPEAT_CLOSE;
+    return 0;
+}
+
+// Returns the level of the long bracket "[==[" at pos (the number of '='), or
+// -1 if there isn't one.
+static int longBracketLevel(const QString &text, int pos)
+{
+    int length = text.length();
+    if (pos >= length || text.at(pos) != QLatin1Char('['))
+        return -1;
+    int i = pos + 1;
+    while (i < length && text.at(i) == QLatin1Char('='))
+        ++i;
+    return (i < length && text.at(i) == QLatin1Char('[')) ? i - pos - 1 : -1;
+}
+
+// Returns the index after the closing long bracket of the given level, or -1.
+static int findLongBracketEnd(const QString &text, int pos, int level)
+{
+    int length = text.length();
+    while ((pos = text.indexOf(QLatin1Char(']'), pos)) != -1) {
+        int i = pos + 1;
+        while (i < length && text.at(i) == QLatin1Char('='))
+            ++i;
+        if (i - pos - 1 == level && i < length && text.at(i) == QLatin1Char(']'))
+            return i + 1;
+        ++pos;
+    }
+    return -1;
+}
 
+// A block that ends inside a long string or comment has a state giving the
+// level of its brackets.  0 is a block that ends normally.
+static int longBracketState(int level, bool comment)
+{
+    return ((level + 1) << 1) | (comment ? 1 : 0);
 }
 
+// The text is scanned once from left to right.  Brackets inside strings and
+// comments aren't recorded for matchParentheses().
 void Highlighter::highlightBlock(const QString &text)
 {
     TextBlockData *data = new TextBlockData;
-    findMatches(text, data, '(', ')');
-    findMatches(text, data, '{', '}');
-    setCurrentBlockUserData(data);
+    setCurrentBlockState(0);
+
+    int length = text.length();
+    int pos = 0;
 
-    foreach (const HighlightingRule &rule, highlightingRules) {
-        QRegExp expression(rule.pattern);
-        int index = expression.indexIn(text);
-        while (index >= 0) {
-            int length = expression.matchedLength();
-            setFormat(index, length, rule.format);
-            index = expression.indexIn(text, index + length);
+    int state = previousBlockState();
+    if (state >= 2)
+        pos = formatLongBracket(text, 0, 0, (state >> 1) - 1, state & 1);
+
+    while (pos < length) {
+        ushort c = text.at(pos).unicode();
+
+        if (isIdentifierStart(c)) {
+            int start = pos;
+            while (pos < length && isIdentifierChar(text.at(pos).unicode()))
+                ++pos;
+            if (isKeyword(text.constData() + start, pos - start)) {
+                setFormat(start, pos - start, keywordFormat);
+                if (char keyword = blockKeyword(text.constData() + start, pos - start))
+                    addBracket(data, keyword, start, pos - start);
+            }
+            else if (pos < length && text.at(pos) == QLatin1Char('('))
+                setFormat(start, pos - start, functionFormat);
+            continue;
         }
-    }
-//return; ///////////////
-    setCurrentBlockState(0);
-    int startIndex = 0;
-    if (previousBlockState() != 1)
-        startIndex = commentStartExpression.indexIn(text);
-
-    while (startIndex >= 0) {
-        int endIndex = commentEndExpression.indexIn(text, startIndex);
-        int commentLength;
-        if (endIndex == -1) {
-            setCurrentBlockState(1);
-            commentLength = text.length() - startIndex;
-        } else {
-            commentLength = endIndex - startIndex
-                    + commentEndExpression.matchedLength();
+
+        if (isDigit(c) || (c == '.' && pos + 1 < length && isDigit(text.at(pos + 1).unicode()))) {
+            int start = pos;
+            while (pos < length) {
+                ushort d = text.at(pos).unicode();
+                if ((d == 'e' || d == 'E' || d == 'p' || d == 'P') && pos + 1 < length &&
+                        (text.at(pos + 1) == QLatin1Char('+') || text.at(pos + 1) == QLatin1Char('-')))
+                    pos += 2;
+                else if (isIdentifierChar(d) || d == '.')
+                    ++pos;
+                else
+                    break;
+            }
+            setFormat(start, pos - start, numberFormat);
+            continue;
+        }
+
+        if (c == '"' || c == '\'') {
+            int start = pos++;
+            while (pos < length) {
+                ushort d = text.at(pos++).unicode();
+                if (d == '\\')
+                    ++pos;
+                else if (d == c)
+                    break;
+            }
+            pos = qMin(pos, length);
+            setFormat(start, pos - start, quotationFormat);
+            continue;
+        }
+
+        if (c == '-' && pos + 1 < length && text.at(pos + 1) == QLatin1Char('-')) {
+            int level = longBracketLevel(text, pos + 2);
+            if (level < 0) {
+                setFormat(pos, length - pos, singleLineCommentFormat);
+                break;
+            }
+            pos = formatLongBracket(text, pos, pos + 2 + level + 2, level, true);
+            continue;
         }
-        setFormat(startIndex, commentLength, multiLineCommentFormat);
-        startIndex = commentStartExpression.indexIn(text, startIndex + commentLength);
+
+        if (c == '[') {
+            int level = longBracketLevel(text, pos);
+            if (level >= 0) {
+                pos = formatLongBracket(text, pos, pos + level + 2, level, false);
+                continue;
+            }
+        }
+
+        if (c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']')
+            addBracket(data, char(c), pos, 1);
+
+        ++pos;
     }
+
+    setCurrentBlockUserData(data);
+
+    // documentContentsChange() keeps the index the same size as the
+    // document, if it couldn't the index is rebuilt when it is next used.
+    if (!mBracketIndexDirty && mBracketIndex.size() == document()->blockCount())
+        mBracketIndex.setBlock(currentBlock().blockNumber(), data);
+    else
+        mBracketIndexDirty = true;
 }
 
-void Highlighter::findMatches(const QString &text, TextBlockData *data, char ch1, char ch2)
+void Highlighter::addBracket(TextBlockData *data, char c, int position, int length)
 {
-    int leftPos = text.indexOf(ch1);
-    while (leftPos != -1) {
-        ParenthesisInfo *info = new ParenthesisInfo;
-        info->character = ch1;
-        info->position = leftPos;
-
-        data->insert(info);
-        leftPos = text.indexOf(ch1, leftPos + 1);
-    }
+    ParenthesisInfo info;
+    info.character = c;
+    info.position = position;
+    info.length = length;
+    data->append(info);
+}
 
-    int rightPos = text.indexOf(ch2);
-    while (rightPos != -1) {
-        ParenthesisInfo *info = new ParenthesisInfo;
-        info->character = ch2;
-        info->position = rightPos;
+// Blocks were split off or joined to the one holding 'position'.  The leaves
+// after it are moved, QSyntaxHighlighter then calls highlightBlock() for that
+// block and any new ones.
+void Highlighter::documentContentsChange(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(charsRemoved)
+    Q_UNUSED(charsAdded)
+    if (mBracketIndexDirty)
+        return;
+    int count = document()->blockCount() - mBracketIndex.size();
+    if (count == 0)
+        return;
+    int blockNumber = document()->findBlock(position).blockNumber() + 1;
+    if (count > 0)
+        mBracketIndex.insertBlocks(blockNumber, count);
+    else
+        mBracketIndex.removeBlocks(blockNumber, -count);
+}
 
-        data->insert(info);
+const BracketIndex &Highlighter::bracketIndex()
+{
+    if (mBracketIndexDirty || mBracketIndex.size() != document()->blockCount()) {
+        mBracketIndex.rebuild(document());
+        mBracketIndexDirty = false;
+    }
+    return mBracketIndex;
+}
 
-        rightPos = text.indexOf(ch2, rightPos + 1);
+// Formats a long string or comment starting at 'start' whose closing bracket
+// is searched for from 'from'.  Returns the index after it, or the length of
+// the text if it continues in the next block.
+int Highlighter::formatLongBracket(const QString &text, int start, int from,
+                                   int level, bool comment)
+{
+    const QTextCharFormat &format = comment ? multiLineCommentFormat : quotationFormat;
+    int end = findLongBracketEnd(text, from, level);
+    if (end == -1) {
+        setFormat(start, text.length() - start, format);
+        setCurrentBlockState(longBracketState(level, comment));
+        return text.length();
     }
+    setFormat(start, end - start, format);
+    return end;
 }
 
 ////
 
-LuaEditor::LuaEditor()
+LuaEditor::LuaEditor() :
+    mHighlighter(new Highlighter(document())),
+    mSyntaxGeneration(0),
+    mCheckedRevision(-1)
 {
 #if 1
     mCurrentLineColor = QColor(128, 255, 255, 32);
@@ -206,6 +545,17 @@ LuaEditor::LuaEditor()
     connect(&mSyntaxTimer, SIGNAL(timeout()), SLOT(checkSyntax()));
 
     connect(this, SIGNAL(textChanged()), &mSyntaxTimer, SLOT(start()));
+
+    mSyntaxPool.setMaxThreadCount(1);
+}
+
+LuaEditor::~LuaEditor()
+{
+    {
+        QMutexLocker locker(&mSyntaxMutex);
+        ++mSyntaxGeneration;
+    }
+    mSyntaxPool.waitForDone();
 }
 
 void LuaEditor::cursorPositionChanged()
@@ -221,6 +571,9 @@ void LuaEditor::matchParentheses()
 {
     matchParentheses('(', ')');
     matchParentheses('{', '}');
+    matchParentheses('[', ']');
+    matchParentheses(BLOCK_OPEN, BLOCK_CLOSE);
+    matchParentheses(REPEAT_OPEN, REPEAT_CLOSE);
 }
 
 void LuaEditor::updateLineNumberAreaWidth(int newBlockCount)
@@ -258,106 +611,210 @@ void LuaEditor::updateLineNumberArea(const QRect &rect, int dy)
         updateLineNumberAreaWidth(0);
 }
 
-#include "luautils.h"
+class SyntaxCheckJob : public QRunnable
+{
+public:
+    SyntaxCheckJob(LuaEditor *editor, int generation, const QString &text) :
+        mEditor(editor),
+        mGeneration(generation),
+        mText(text)
+    {
+    }
+
+    void run()
+    {
+        if (mEditor->isSyntaxCheckStale(mGeneration))
+            return;
+
+        PooledLuaState L;
+        L->loadString(mText, QLatin1String("chunk"));
+        QString error = L->errorString();
+        int line = 0, column = 0;
+        if (!error.isEmpty())
+            parseError(error, line, column);
+
+        QMetaObject::invokeMethod(mEditor, "syntaxChecked", Qt::QueuedConnection,
+                                  Q_ARG(int, mGeneration), Q_ARG(QString, error),
+                                  Q_ARG(int, line), Q_ARG(int, column));
+    }
 
+private:
+    // Lua's messages look like [string "chunk"]:12: unexpected symbol near 'x'.
+    // The column is where the token after "near" is found on the line.
+    void parseError(QString &error, int &line, int &column)
+    {
+        int n = error.indexOf(QLatin1String("]:"));
+        if (n < 0)
+            return;
+        error = error.mid(n + 2);
+        n = error.indexOf(QLatin1Char(':'));
+        bool ok;
+        line = error.left(n).toInt(&ok);
+        if (n < 0 || !ok) {
+            line = 0;
+            return;
+        }
+        error = error.mid(n + 1).trimmed();
+
+        QString lineText = textOfLine(line);
+        if (error.endsWith(QLatin1String("near <eof>"))) {
+            column = lineText.length() + 1;
+        } else if ((n = error.lastIndexOf(QLatin1String("near '"))) >= 0) {
+            QString token = error.mid(n + 6);
+            token.chop(1);
+            if (!token.isEmpty())
+                column = lineText.indexOf(token) + 1;
+        }
+    }
+
+    QString textOfLine(int line)
+    {
+        int start = 0;
+        while (--line > 0 && start != -1) {
+            start = mText.indexOf(QLatin1Char('\n'), start);
+            if (start != -1)
+                ++start;
+        }
+        if (start == -1)
+            return QString();
+        int end = mText.indexOf(QLatin1Char('\n'), start);
+        return mText.mid(start, (end == -1) ? -1 : end - start);
+    }
+
+    LuaEditor *mEditor;
+    int mGeneration;
+    QString mText;
+};
+
+// Called by the timer after the text stops changing.  The text is copied here
+// but converted and parsed on the worker thread.
 void LuaEditor::checkSyntax()
 {
-    LuaState L;
-    L.loadString(toPlainText(), QLatin1String("chunk"));
-    QString error = L.errorString();
-    if (!error.isEmpty()) {
-        int n = error.indexOf(QLatin1String("]:"));
-        if (n >= 0)
-            error = error.mid(n + 2);
+    if (document()->revision() == mCheckedRevision)
+        return;
+    mCheckedRevision = document()->revision();
+
+    int generation;
+    {
+        QMutexLocker locker(&mSyntaxMutex);
+        generation = ++mSyntaxGeneration;
     }
-    emit syntaxError(error);
+    mSyntaxPool.start(new SyntaxCheckJob(this, generation, toPlainText()));
+}
+
+void LuaEditor::syntaxChecked(int generation, const QString &error, int line, int column)
+{
+    if (isSyntaxCheckStale(generation))
+        return;
+    emit syntaxError(error, line, column);
+}
+
+// Called by the worker thread.
+bool LuaEditor::isSyntaxCheckStale(int generation)
+{
+    QMutexLocker locker(&mSyntaxMutex);
+    return generation != mSyntaxGeneration;
 }
 
 void LuaEditor::matchParentheses(char ch1, char ch2)
 {
-    TextBlockData *data = static_cast<TextBlockData *>(textCursor().block().userData());
+    QTextBlock block = textCursor().block();
+    TextBlockData *data = static_cast<TextBlockData *>(block.userData());
 
     if (data) {
-        QVector<ParenthesisInfo *> infos = data->parentheses();
+        const QVector<ParenthesisInfo> &infos = data->parentheses();
 
-        int pos = textCursor().block().position();
+        int pos = block.position();
+        int curPos = textCursor().position() - pos;
         for (int i = 0; i < infos.size(); ++i) {
-            ParenthesisInfo *info = infos.at(i);
-
-            int curPos = textCursor().position() - textCursor().block().position();
-            if (info->position == curPos - 1 && info->character == ch1) {
-                if (matchLeftParenthesis(ch1, ch2, textCursor().block(), i + 1, 0))
-                    createParenthesisSelection(pos + info->position);
-            } else if (info->position == curPos - 1 && info->character == ch2) {
-                if (matchRightParenthesis(ch1, ch2, textCursor().block(), i - 1, 0))
-                    createParenthesisSelection(pos + info->position);
+            const ParenthesisInfo &info = infos.at(i);
+
+            // The cursor is just after a bracket or within or after a keyword.
+            if (curPos <= info.position || curPos > info.position + info.length)
+                continue;
+            if (info.character == ch1) {
+                if (matchLeftParenthesis(ch1, ch2, block, i))
+                    createParenthesisSelection(pos + info.position, info.length);
+            } else if (info.character == ch2) {
+                if (matchRightParenthesis(ch1, ch2, block, i))
+                    createParenthesisSelection(pos + info.position, info.length);
             }
         }
     }
 }
 
-bool LuaEditor::matchLeftParenthesis(char ch1, char ch2, QTextBlock currentBlock, int i, int numLeftParentheses)
+// Returns the index of the bracket that brings 'depth' to 0, or -1.
+static int scanForward(const QVector<ParenthesisInfo> &infos, int i, char ch1, char ch2, int &depth)
 {
-    TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
-    QVector<ParenthesisInfo *> infos = data->parentheses();
-
-    int docPos = currentBlock.position();
     for (; i < infos.size(); ++i) {
-        ParenthesisInfo *info = infos.at(i);
-
-        if (info->character == ch1) {
-            ++numLeftParentheses;
-            continue;
-        }
-
-        if (info->character == ch2 && numLeftParentheses == 0) {
-            createParenthesisSelection(docPos + info->position);
-            return true;
-        } else
-            --numLeftParentheses;
+        if (infos.at(i).character == ch1)
+            ++depth;
+        else if (infos.at(i).character == ch2 && --depth == 0)
+            return i;
     }
+    return -1;
+}
 
-    currentBlock = currentBlock.next();
-    if (currentBlock.isValid())
-        return matchLeftParenthesis(ch1, ch2, currentBlock, 0, numLeftParentheses);
-
-    return false;
+static int scanBackward(const QVector<ParenthesisInfo> &infos, int i, char ch1, char ch2, int &depth)
+{
+    for (; i >= 0; --i) {
+        if (infos.at(i).character == ch2)
+            ++depth;
+        else if (infos.at(i).character == ch1 && --depth == 0)
+            return i;
+    }
+    return -1;
 }
 
-bool LuaEditor::matchRightParenthesis(char ch1, char ch2, QTextBlock currentBlock, int i, int numRightParentheses)
+// The rest of the current block is scanned, then the bracket index gives the
+// block with the match without visiting the blocks in between.
+bool LuaEditor::matchLeftParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index)
 {
     TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
-    QVector<ParenthesisInfo *> parentheses = data->parentheses();
-
-    int docPos = currentBlock.position();
-    for (; i > -1 && parentheses.size() > 0; --i) {
-        ParenthesisInfo *info = parentheses.at(i);
-        if (info->character == ch2) {
-            ++numRightParentheses;
-            continue;
-        }
-        if (info->character == ch1 && numRightParentheses == 0) {
-            createParenthesisSelection(docPos + info->position);
-            return true;
-        } else
-            --numRightParentheses;
+    int depth = 1;
+    int i = scanForward(data->parentheses(), index + 1, ch1, ch2, depth);
+    if (i == -1) {
+        int blockNumber = mHighlighter->bracketIndex().findClose(ch1, ch2, currentBlock.blockNumber(), depth);
+        if (blockNumber == -1)
+            return false;
+        currentBlock = document()->findBlockByNumber(blockNumber);
+        data = static_cast<TextBlockData *>(currentBlock.userData());
+        if (!data)
+            return false;
+        i = scanForward(data->parentheses(), 0, ch1, ch2, depth);
+        if (i == -1)
+            return false;
     }
 
-    currentBlock = currentBlock.previous();
-    if (currentBlock.isValid()) {
-#if 1 // BUG IN ORIGINAL
+    const ParenthesisInfo &info = data->parentheses().at(i);
+    createParenthesisSelection(currentBlock.position() + info.position, info.length);
+    return true;
+}
+
+bool LuaEditor::matchRightParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index)
+{
+    TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
+    int depth = 1;
+    int i = scanBackward(data->parentheses(), index - 1, ch1, ch2, depth);
+    if (i == -1) {
+        int blockNumber = mHighlighter->bracketIndex().findOpen(ch1, ch2, currentBlock.blockNumber(), depth);
+        if (blockNumber == -1)
+            return false;
+        currentBlock = document()->findBlockByNumber(blockNumber);
         data = static_cast<TextBlockData *>(currentBlock.userData());
-        parentheses = data->parentheses();
-        return matchRightParenthesis(ch1, ch2, currentBlock, parentheses.size() - 1, numRightParentheses);
-#else
-        return matchRightParenthesis(ch1, ch2, currentBlock, 0, numRightParentheses);
-#endif
+        if (!data)
+            return false;
+        i = scanBackward(data->parentheses(), data->parentheses().size() - 1, ch1, ch2, depth);
+        if (i == -1)
+            return false;
     }
 
-    return false;
+    const ParenthesisInfo &info = data->parentheses().at(i);
+    createParenthesisSelection(currentBlock.position() + info.position, info.length);
+    return true;
 }
 
-void LuaEditor::createParenthesisSelection(int pos)
+void LuaEditor::createParenthesisSelection(int pos, int length)
 {
     QList<QTextEdit::ExtraSelection> selections = extraSelections();
 
@@ -369,7 +826,7 @@ void LuaEditor::createParenthesisSelection(int pos)
 
     QTextCursor cursor = textCursor();
     cursor.setPosition(pos);
-    cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
+    cursor.setPosition(pos + length, QTextCursor::KeepAnchor);
     selection.cursor = cursor;
 
     selections.append(selection);
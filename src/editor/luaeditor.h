@@ -18,16 +18,27 @@
 #ifndef LUAEDITOR_H
 #define LUAEDITOR_H
 
+#include <QMutex>
 #include <QPlainTextEdit>
 #include <QSyntaxHighlighter>
+#include <QThreadPool>
 #include <QTimer>
 
+class Highlighter;
 class LineNumberArea;
+class SyntaxCheckJob;
+
+// ParenthesisInfo::character for the keywords that open and close blocks.
+#define BLOCK_OPEN 'B' // function, do, if
+#define BLOCK_CLOSE 'E' // end
+#define REPEAT_OPEN 'R' // repeat
+#define REPEAT_CLOSE 'U' // until
 
 struct ParenthesisInfo
 {
-    char character;
+    char character; // a bracket or one of the keyword characters above
     int position;
+    int length;
 };
 
 class TextBlockData : public QTextBlockUserData
@@ -35,34 +46,86 @@ class TextBlockData : public QTextBlockUserData
 public:
     TextBlockData();
 
-    QVector<ParenthesisInfo *> parentheses();
-    void insert(ParenthesisInfo *info);
+    const QVector<ParenthesisInfo> &parentheses() const
+    { return m_parentheses; }
+
+    // Must be added in order of position.
+    void append(const ParenthesisInfo &info);
+
+private:
+    QVector<ParenthesisInfo> m_parentheses;
+};
+
+// The brackets of every block in a document, used to find the block holding
+// a matching bracket in O(log n).  For each kind of bracket a segment tree
+// over the block numbers records how a run of blocks changes the nesting
+// depth and how far the depth dips scanning forwards or backwards.
+class BracketIndex
+{
+public:
+    BracketIndex();
+
+    int size() const { return mSize; }
+
+    void rebuild(QTextDocument *document);
+    void setBlock(int blockNumber, const TextBlockData *data);
+
+    // Added blocks have no brackets until setBlock() is called for them.
+    void insertBlocks(int blockNumber, int count);
+    void removeBlocks(int blockNumber, int count);
+
+    // The first block after blockNumber that closes 'depth' open brackets,
+    // or -1.  'depth' is updated to the depth at the start of that block.
+    int findClose(char open, char close, int blockNumber, int &depth) const;
+
+    // The last block before blockNumber that opens 'depth' closed brackets,
+    // or -1.  'depth' is updated to the depth at the end of that block.
+    int findOpen(char open, char close, int blockNumber, int &depth) const;
 
 private:
-    QVector<ParenthesisInfo *> m_parentheses;
+    struct Node
+    {
+        int mDelta; // opened minus closed
+        int mMinForward; // lowest depth reached scanning forwards, <= 0
+        int mMinBackward; // same scanning backwards, where closing opens
+    };
+
+    enum { KindCount = 5 };
+    static int kindOf(char open, char close);
+    void setLeaf(int kind, int blockNumber, const TextBlockData *data);
+    void combine(int kind, int node);
+    void moveLeaves(int blockNumber, int count);
+    int findForward(int kind, int node, int first, int last, int from, int &depth) const;
+    int findBackward(int kind, int node, int first, int last, int to, int &depth) const;
+
+    int mSize; // number of blocks
+    int mCapacity; // number of leaves, a power of 2
+    QVector<Node> mNodes[KindCount]; // mNodes[kind][1] is the root
 };
 
 class Highlighter : public QSyntaxHighlighter
 {
+    Q_OBJECT
 public:
     Highlighter(QTextDocument *parent = 0);
 
+    // Brought up to date first if blocks were added or removed.
+    const BracketIndex &bracketIndex();
+
 protected:
     void highlightBlock(const QString &text);
-    void findMatches(const QString &text, TextBlockData *data, char ch1, char ch2);
+    int formatLongBracket(const QString &text, int start, int from, int level, bool comment);
+    void addBracket(TextBlockData *data, char c, int position, int length);
 
-private:
-    struct HighlightingRule
-    {
-        QRegExp pattern;
-        QTextCharFormat format;
-    };
-    QVector<HighlightingRule> highlightingRules;
+private slots:
+    void documentContentsChange(int position, int charsRemoved, int charsAdded);
 
-    QRegExp commentStartExpression;
-    QRegExp commentEndExpression;
+private:
+    BracketIndex mBracketIndex;
+    bool mBracketIndexDirty;
 
     QTextCharFormat keywordFormat;
+    QTextCharFormat numberFormat;
     QTextCharFormat singleLineCommentFormat;
     QTextCharFormat multiLineCommentFormat;
     QTextCharFormat quotationFormat;
@@ -74,9 +137,12 @@ class LuaEditor : public QPlainTextEdit
     Q_OBJECT
 public:
     LuaEditor();
+    ~LuaEditor();
 
 signals:
-    void syntaxError(const QString &error);
+    // The error is empty when the syntax is OK.  Line and column start at 1,
+    // either may be 0 if it isn't known.
+    void syntaxError(const QString &error, int line, int column);
 
 private slots:
     void cursorPositionChanged();
@@ -88,22 +154,34 @@ private slots:
     void updateLineNumberArea(const QRect &rect, int dy);
 
     void checkSyntax();
+    void syntaxChecked(int generation, const QString &error, int line, int column);
 
 protected:
     void matchParentheses(char ch1, char ch2);
-    bool matchLeftParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index, int numRightParentheses);
-    bool matchRightParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index, int numLeftParentheses);
-    void createParenthesisSelection(int pos);
+    bool matchLeftParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index);
+    bool matchRightParenthesis(char ch1, char ch2, QTextBlock currentBlock, int index);
+    void createParenthesisSelection(int pos, int length = 1);
 
     void resizeEvent(QResizeEvent *e);
     void lineNumberAreaPaintEvent(QPaintEvent *event);
     int lineNumberAreaWidth();
 
     LineNumberArea *lineNumberArea;
+    Highlighter *mHighlighter;
     QColor mCurrentLineColor;
     QTimer mSyntaxTimer;
 
+    // Syntax is checked on a worker thread using a copy of the text.  Each
+    // check gets a new generation, a check that is no longer the latest one
+    // is skipped if it hasn't started and its result is ignored if it has.
+    bool isSyntaxCheckStale(int generation);
+    QThreadPool mSyntaxPool;
+    QMutex mSyntaxMutex;
+    int mSyntaxGeneration; // guarded by mSyntaxMutex
+    int mCheckedRevision;
+
     friend class LineNumberArea;
+    friend class SyntaxCheckJob;
 };
 
 class LineNumberArea : public QWidget
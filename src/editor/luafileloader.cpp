@@ -0,0 +1,179 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luafileloader.h"
+
+#include "luamanager.h"
+#include "metaeventmanager.h"
+#include "node.h"
+#ifndef EDITOR_NO_GUI
+#include "progress.h"
+#endif
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+class LuaFileLoaderJob : public QRunnable
+{
+public:
+    LuaFileLoaderJob(LuaFileLoader *loader) :
+        mLoader(loader)
+    {
+    }
+
+    void run()
+    {
+        read();
+        mLoader->jobFinished();
+    }
+
+protected:
+    virtual void read() = 0;
+
+private:
+    LuaFileLoader *mLoader;
+};
+
+class CommandFileJob : public LuaFileLoaderJob
+{
+public:
+    CommandFileJob(LuaFileLoader *loader, LuaFileLoader::CommandResult *result) :
+        LuaFileLoaderJob(loader),
+        mResult(result)
+    {
+    }
+
+protected:
+    void read()
+    {
+        mResult->mOK = LuaManager::readLuaFile(mResult->mPath, mResult->mEntry);
+    }
+
+private:
+    LuaFileLoader::CommandResult *mResult;
+};
+
+class EventFileJob : public LuaFileLoaderJob
+{
+public:
+    EventFileJob(LuaFileLoader *loader, LuaFileLoader::EventResult *result) :
+        LuaFileLoaderJob(loader),
+        mResult(result)
+    {
+    }
+
+protected:
+    void read()
+    {
+        MetaEventFile file;
+        mResult->mOK = file.read(mResult->mPath);
+        mResult->mNodes = file.takeNodes();
+    }
+
+private:
+    LuaFileLoader::EventResult *mResult;
+};
+
+/////
+
+LuaFileLoader::LuaFileLoader(QObject *parent) :
+    QObject(parent),
+    mThreadCount(0),
+    mFinished(0)
+{
+}
+
+QVector<LuaFileLoader::CommandResult> LuaFileLoader::readCommandFiles(const QStringList &paths)
+{
+    // The vector isn't resized while the jobs run, so each job can safely
+    // write to its own element.
+    QVector<CommandResult> results(paths.size());
+    QList<LuaFileLoaderJob*> jobs;
+    for (int i = 0; i < paths.size(); i++) {
+        results[i].mPath = paths[i];
+        jobs += new CommandFileJob(this, &results[i]);
+    }
+    runJobs(jobs);
+    return results;
+}
+
+QVector<LuaFileLoader::EventResult> LuaFileLoader::readEventFiles(const QStringList &paths)
+{
+    QVector<EventResult> results(paths.size());
+    QList<LuaFileLoaderJob*> jobs;
+    for (int i = 0; i < paths.size(); i++) {
+        results[i].mPath = paths[i];
+        jobs += new EventFileJob(this, &results[i]);
+    }
+    runJobs(jobs);
+    return results;
+}
+
+void LuaFileLoader::runJobs(QList<LuaFileLoaderJob *> jobs)
+{
+    if (jobs.isEmpty())
+        return;
+
+    mFinished = 0;
+    int total = jobs.size();
+
+#ifndef EDITOR_NO_GUI
+    bool showProgress = !mProgressText.isEmpty() && Progress::instance()->mainWindow();
+    if (showProgress)
+        Progress::instance()->begin(mProgressText.arg(0).arg(total));
+#endif
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(mThreadCount > 0 ? mThreadCount : QThread::idealThreadCount());
+    foreach (LuaFileLoaderJob *job, jobs)
+        pool.start(job); // the pool deletes the job when it's done
+
+    int reported = -1;
+    do {
+        int done = finishedCount();
+        if (done != reported) {
+            emit progress(done, total);
+#ifndef EDITOR_NO_GUI
+            if (showProgress)
+                Progress::instance()->update(mProgressText.arg(done).arg(total));
+#endif
+            reported = done;
+        }
+    } while (!pool.waitForDone(50));
+
+    if (reported != total)
+        emit progress(total, total);
+
+#ifndef EDITOR_NO_GUI
+    if (showProgress)
+        Progress::instance()->end();
+#endif
+}
+
+void LuaFileLoader::jobFinished()
+{
+    QMutexLocker locker(&mMutex);
+    ++mFinished;
+}
+
+int LuaFileLoader::finishedCount()
+{
+    QMutexLocker locker(&mMutex);
+    return mFinished;
+}
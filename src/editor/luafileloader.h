@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LUAFILELOADER_H
+#define LUAFILELOADER_H
+
+#include "editor_global.h"
+#include "luacache.h"
+
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+
+class LuaFileLoaderJob;
+
+// Reads a batch of .lua files on a pool of worker threads.  Every file gets
+// its own lua_State so the files are independent of each other.  The workers
+// only produce plain data; the caller merges the results on the GUI thread.
+// The read*Files() methods block until every file has been read.
+class LuaFileLoader : public QObject
+{
+    Q_OBJECT
+public:
+    class CommandResult
+    {
+    public:
+        CommandResult() : mOK(false) {}
+        QString mPath;
+        bool mOK;
+        LuaCacheEntry mEntry;
+    };
+
+    class EventResult
+    {
+    public:
+        EventResult() : mOK(false) {}
+        QString mPath;
+        bool mOK;
+        QList<MetaEventNode*> mNodes; // owned by the caller
+    };
+
+    explicit LuaFileLoader(QObject *parent = 0);
+
+    // Zero means QThread::idealThreadCount().
+    void setThreadCount(int count)
+    { mThreadCount = count; }
+
+    // When set, Progress is updated with this text; %1 and %2 are replaced
+    // by the number of files read and the total number of files.
+    void setProgressText(const QString &text)
+    { mProgressText = text; }
+
+    QVector<CommandResult> readCommandFiles(const QStringList &paths);
+    QVector<EventResult> readEventFiles(const QStringList &paths);
+
+signals:
+    void progress(int done, int total);
+
+private:
+    void runJobs(QList<LuaFileLoaderJob*> jobs);
+    void jobFinished();
+    int finishedCount();
+
+    int mThreadCount;
+    QString mProgressText;
+    QMutex mMutex;
+    int mFinished;
+
+    friend class LuaFileLoaderJob;
+};
+
+#endif // LUAFILELOADER_H
@@ -17,16 +17,25 @@
 
 #include "luamanager.h"
 
+#include "luacache.h"
+#include "luafileloader.h"
 #include "luautils.h"
 #include "node.h"
 #include "preferences.h"
 #include "scriptvariable.h"
 
+#include <QDateTime>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 
 SINGLETON_IMPL(LuaManager)
 
+static QString cacheFileName()
+{
+    return prefs()->configPath(QLatin1String("scripted-lua.cache"));
+}
+
 LuaManager::LuaManager(QObject *parent) :
     QObject(parent)
 {
@@ -39,6 +48,20 @@ LuaManager::LuaManager(QObject *parent) :
             SLOT(fileChangedTimeout()));
 
     connect(prefs(), SIGNAL(gameDirectoriesChanged()), SLOT(gameDirectoriesChanged()));
+
+    // Saving is deferred so a rescan writes the cache once.
+    mWriteCacheTimer.setInterval(2000);
+    mWriteCacheTimer.setSingleShot(true);
+    connect(&mWriteCacheTimer, SIGNAL(timeout()), SLOT(writeCache()));
+
+    if (!mCache.read(cacheFileName()))
+        qDebug() << "LuaManager:" << mCache.errorString();
+    pruneCache();
+}
+
+LuaManager::~LuaManager()
+{
+    writeCache();
 }
 
 LuaInfo *LuaManager::luaInfo(const QString &fileName, const QString &relativeTo)
@@ -88,6 +111,10 @@ bool LuaManager::readLuaFiles()
     QStringList filters;
     filters << QLatin1String("*.lua");
 
+    // Only files that aren't loaded already and aren't in the cache need to
+    // be run.
+    QStringList paths, changed;
+    QSet<QString> seen;
     foreach (QString path, prefs()->gameDirectories()) {
         QDir dir = QDir(path).filePath(QLatin1String("media/lua/MetaGame"));
         if (!dir.exists()) {
@@ -95,15 +122,61 @@ bool LuaManager::readLuaFiles()
             continue;
         }
         foreach (QFileInfo fileInfo, dir.entryInfoList(filters)) {
-            if (LuaInfo *info = luaInfo(fileInfo.absoluteFilePath()))
-                if (!mCommands.contains(info))
-                    mCommands += info;
+            QString path = fileInfo.canonicalFilePath();
+            if (path.isEmpty() || seen.contains(path))
+                continue;
+            seen.insert(path);
+            paths += path;
+            if (mLuaInfo.contains(path) && mLuaInfo[path]->node())
+                continue;
+            if (mCache.entry(fileInfo))
+                continue;
+            changed += path;
         }
     }
 
+    LuaFileLoader loader;
+    loader.setThreadCount(prefs()->loaderThreadCount());
+    loader.setProgressText(tr("Reading Lua files (%1/%2)"));
+    QSet<QString> failed;
+    foreach (const LuaFileLoader::CommandResult &result, loader.readCommandFiles(changed)) {
+        if (result.mOK)
+            mCache.insert(result.mEntry);
+        else
+            failed.insert(result.mPath);
+    }
+    pruneCache();
+    if (mCache.isDirty())
+        mWriteCacheTimer.start();
+
+    foreach (QString path, paths) {
+        if (failed.contains(path))
+            continue;
+        if (LuaInfo *info = luaInfo(path))
+            if (!mCommands.contains(info))
+                mCommands += info;
+    }
+
     return true;
 }
 
+// Drops the entries of deleted or renamed files so the cache doesn't grow
+// forever.
+void LuaManager::pruneCache()
+{
+    foreach (const QString &path, mCache.paths()) {
+        if (!QFileInfo(path).exists())
+            mCache.remove(path);
+    }
+}
+
+void LuaManager::writeCache()
+{
+    mWriteCacheTimer.stop();
+    if (mCache.isDirty() && !mCache.write(cacheFileName()))
+        qDebug() << "LuaManager:" << mCache.errorString();
+}
+
 void LuaManager::gameDirectoriesChanged()
 {
     readLuaFiles();
@@ -118,6 +191,11 @@ void LuaManager::fileChanged(const QString &path)
 void LuaManager::fileChangedTimeout()
 {
     foreach (const QString &path, mChangedFiles) {
+        if (!QFileInfo(path).exists()) {
+            mCache.remove(path);
+            if (mCache.isDirty())
+                mWriteCacheTimer.start();
+        }
         if (mLuaInfo.contains(path)) {
             noise() << "LuaManager::fileChanged" << path;
             mFileSystemWatcher.removePath(path);
@@ -125,12 +203,17 @@ void LuaManager::fileChangedTimeout()
             if (info.exists()) {
                 mFileSystemWatcher.addPath(path);
                 LuaInfo *info = mLuaInfo[path];
-                delete info->mNode;
+                LuaNode *oldNode = info->mNode;
                 info->mNode = loadLua(path);
                 if (!info->mNode) {
                     // ???
                 }
-                emit infoChanged(info);
+                // Nodes using this file only need syncing if the inputs,
+                // outputs or variables changed.
+                bool changed = !info->mNode || !info->mNode->sameSignature(oldNode);
+                delete oldNode;
+                if (changed)
+                    emit infoChanged(info);
             }
         }
     }
@@ -138,139 +221,113 @@ void LuaManager::fileChangedTimeout()
     mChangedFiles.clear();
 }
 
+QSet<QString> LuaManager::cachedPaths() const
+{
+    return QSet<QString>::fromList(mCache.paths());
+}
+
+void LuaManager::insertCacheEntry(const LuaCacheEntry &entry)
+{
+    mCache.insert(entry);
+    mWriteCacheTimer.start();
+}
+
 LuaNode *LuaManager::loadLua(const QString &fileName)
 {
-    if (!QFileInfo(fileName).exists())
+    QFileInfo fileInfo(fileName);
+    if (!fileInfo.exists())
         return NULL;
 
-#if 1
-    LuaState L;
-    if (!L.loadFile(fileName))
-        return NULL;
+    if (const LuaCacheEntry *entry = mCache.entry(fileInfo)) {
+        if (mCache.isDirty())
+            mWriteCacheTimer.start();
+        return entry->toNode();
+    }
 
-    LuaValue lv = L.getGlobal(QLatin1String("editor"));
-    if (lv.type() != LUA_TTABLE)
+    LuaCacheEntry entry;
+    if (!readLuaFile(fileName, entry))
         return NULL;
 
-    LuaNode node(0, QFileInfo(fileName).baseName());
-
-    for (int i = 0; i < lv.mTableValue.size(); i++) {
-        LuaValue *k = lv.mTableValue.mKeys[i];
-        LuaValue *v = lv.mTableValue.mValues[i];
-        if (k->isString(QLatin1String("inputs"))) {
-            if (!v->isTable()) return NULL;
-            for (int j = 0; j < v->mTableValue.size(); j++) {
-                LuaValue *k2 = v->mTableValue.mKeys[j];
-                LuaValue *v2 = v->mTableValue.mValues[j];
-                if (!v2->isTable()) return false;
-                QMap<QString,QString> ssm = v2->mTableValue.toStringStringMap();
-                QString name = ssm[QLatin1String("name")];
-                if (node.input(name)) return false;
-                QString label = ssm[QLatin1String("label")];
-                if (label.isEmpty()) label = name;
-                node.insertInput(node.inputCount(), new NodeInput(name, label));
+    mCache.insert(entry);
+    mWriteCacheTimer.start();
+
+    return entry.toNode();
+}
+
+// This is called by LuaFileLoader's worker threads, so it must not touch any
+// LuaManager state.
+bool LuaManager::readLuaFile(const QString &fileName, LuaCacheEntry &entry)
+{
+    QFileInfo fileInfo(fileName);
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    entry.mPath = fileInfo.canonicalFilePath();
+    entry.mLastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    entry.mSize = fileInfo.size();
+    entry.mHash = LuaCache::hash(file.readAll());
+    file.close();
+
+    PooledLuaState L;
+    if (!L->loadFile(fileName))
+        return false;
+
+    // Only a few keys are needed, so walk the table in place rather than
+    // converting all of it.
+    LuaStackGuard guard(*L);
+    LuaCursor editor = L->global("editor");
+    if (!editor.isTable())
+        return false;
+
+    LuaTableIterator it(editor);
+    while (it.next()) {
+        LuaCursor k = it.key();
+        LuaCursor v = it.value();
+        if (k.isString("inputs")) {
+            if (!v.isTable()) return false;
+            LuaTableIterator it2(v);
+            while (it2.next()) {
+                LuaCursor v2 = it2.value();
+                if (!v2.isTable()) return false;
+                LuaCacheEntry::Port input;
+                input.mName = v2.field("name").toString();
+                if (entry.hasInput(input.mName)) return false;
+                input.mLabel = v2.field("label").toString();
+                if (input.mLabel.isEmpty()) input.mLabel = input.mName;
+                entry.mInputs += input;
             }
         }
-        if (k->isString(QLatin1String("outputs"))) {
-            if (!v->isTable()) return NULL;
-            for (int j = 0; j < v->mTableValue.size(); j++) {
-                LuaValue *k2 = v->mTableValue.mKeys[j];
-                LuaValue *v2 = v->mTableValue.mValues[j];
-                if (!v2->isTable()) return false;
-                QMap<QString,QString> ssm = v2->mTableValue.toStringStringMap();
-                QString name = ssm[QLatin1String("name")];
-                if (node.output(name)) return false;
-                QString label = ssm[QLatin1String("label")];
-                if (label.isEmpty()) label = name;
-                node.insertOutput(node.outputCount(), new NodeOutput(name, label));
+        if (k.isString("outputs")) {
+            if (!v.isTable()) return false;
+            LuaTableIterator it2(v);
+            while (it2.next()) {
+                LuaCursor v2 = it2.value();
+                if (!v2.isTable()) return false;
+                LuaCacheEntry::Port output;
+                output.mName = v2.field("name").toString();
+                if (entry.hasOutput(output.mName)) return false;
+                output.mLabel = v2.field("label").toString();
+                if (output.mLabel.isEmpty()) output.mLabel = output.mName;
+                entry.mOutputs += output;
             }
         }
-        if (k->isString(QLatin1String("variables"))) {
-            if (!v->isTable()) return NULL;
-            for (int j = 0; j < v->mTableValue.size(); j++) {
-                LuaValue *k2 = v->mTableValue.mKeys[j];
-                LuaValue *v2 = v->mTableValue.mValues[j];
-                if (!v2->isTable()) return false;
-                QMap<QString,QString> ssm = v2->mTableValue.toStringStringMap();
-                QString name = ssm[QLatin1String("name")];
-                if (node.variable(name)) return false;
-                QString type = ssm[QLatin1String("type")];
-                QString label = ssm[QLatin1String("label")];
-                if (label.isEmpty()) label = name;
-                QString value = ssm[QLatin1String("value")];
-                node.insertVariable(node.variableCount(), new ScriptVariable(type, name, label, value));
+        if (k.isString("variables")) {
+            if (!v.isTable()) return false;
+            LuaTableIterator it2(v);
+            while (it2.next()) {
+                LuaCursor v2 = it2.value();
+                if (!v2.isTable()) return false;
+                LuaCacheEntry::Variable var;
+                var.mName = v2.field("name").toString();
+                if (entry.hasVariable(var.mName)) return false;
+                var.mType = v2.field("type").toString();
+                var.mLabel = v2.field("label").toString();
+                if (var.mLabel.isEmpty()) var.mLabel = var.mName;
+                var.mValue = v2.field("value").toString();
+                entry.mVariables += var;
             }
         }
     }
 
-    return new LuaNode(0, node);
-#else
-    if (lua_State *L = luaL_newstate()) {
-
-        LuaNode *ret = 0;
-
-        luaL_openlibs(L);
-        lua_pushboolean(L, true);
-        lua_setglobal(L, "_SCRIPTED_");
-        int status = luaL_loadfile(L, fileName.toLatin1().data());
-        if (status == LUA_OK) {
-            status = lua_pcall(L, 0, 0, -1); // call the closure?
-            if (status == LUA_OK) {
-                lua_getglobal(L, "editor");
-                int tblidx = lua_gettop(L);
-                if (lua_istable(L, tblidx)) {
-                    ret = new LuaNode(0, QFileInfo(fileName).baseName());
-                    lua_pushnil(L); // push space on stack for the key
-                    while (lua_next(L, tblidx) != 0) { // pop a key, push key then value
-                        const char *key = lua_isstring(L, -2) ? lua_tostring(L, -2) : "";
-                        if (!strcmp(key, "inputs")) {
-                            if (!lua_istable(L, -1))
-                                return NULL; // FIXME: lua_close
-                            lua_pushnil(L); // space for key
-                            while (lua_next(L, -2) != 0) { // pop a key, push key then value
-                                const char *s = lua_tostring(L, -1);
-                                ret->insertInput(ret->inputCount(), new NodeInput(QLatin1String(s)));
-                                lua_pop(L, 1); // pop value
-                            }
-                        } else if (!strcmp(key, "outputs")) {
-                            if (!lua_istable(L, -1))
-                                return NULL; // FIXME: lua_close
-                            lua_pushnil(L); // space for key
-                            while (lua_next(L, -2) != 0) { // pop a key, push key then value
-                                const char *s = lua_tostring(L, -1);
-                                ret->insertOutput(ret->outputCount(), new NodeOutput(QLatin1String(s)));
-                                lua_pop(L, 1); // pop value
-                            }
-                        } else if (!strcmp(key, "variables")) {
-                            if (!lua_istable(L, -1))
-                                return NULL; // FIXME: lua_close
-                            lua_pushnil(L); // space for key
-                            while (lua_next(L, -2) != 0) { // pop a key, push key then value
-                                if (!lua_istable(L, -1))
-                                    return NULL; // FIXME: lua_close
-                                QMap<QString,QString> kv;
-                                lua_pushnil(L); // space for key
-                                while (lua_next(L, -2) != 0) { // pop a key, push key then value
-                                    const char *key = lua_tostring(L, -2);
-                                    const char *value = lua_tostring(L, -1);
-                                    kv[QLatin1String(key)] = QLatin1String(value);
-                                    lua_pop(L, 1); // pop value
-                                }
-                                ret->insertVariable(ret->variableCount(),
-                                                    new ScriptVariable(kv[QLatin1String("type")],
-                                                    kv[QLatin1String("name")],
-                                        kv[QLatin1String("value")]));
-                                lua_pop(L, 1); // pop value
-                            }
-                        }
-                        lua_pop(L, 1); // pop value
-                    }
-                }
-            }
-        }
-        lua_close(L);
-        return ret;
-    }
-#endif
-    return NULL;
+    return true;
 }
@@ -20,6 +20,7 @@
 
 #include "editor_global.h"
 #include "filesystemwatcher.h"
+#include "luacache.h"
 #include "singleton.h"
 
 #include <Map>
@@ -43,15 +44,24 @@ class LuaManager : public QObject, public Singleton<LuaManager>
     Q_OBJECT
 public:
     explicit LuaManager(QObject *parent = 0);
+    ~LuaManager();
 
     LuaInfo *luaInfo(const QString &fileName, const QString &relativeTo = QString());
-    QString canonicalPath(const QString &fileName, const QString &relativeTo = QString());
+    static QString canonicalPath(const QString &fileName, const QString &relativeTo = QString());
 
     const QList<LuaInfo*> &commands() const
     { return mCommands; }
 
     bool readLuaFiles();
 
+    static bool readLuaFile(const QString &fileName, LuaCacheEntry &entry);
+
+    // Files with an entry in the cache, which may be out of date.
+    QSet<QString> cachedPaths() const;
+
+    // Adds an entry read by readLuaFile() on another thread.
+    void insertCacheEntry(const LuaCacheEntry &entry);
+
 signals:
     void infoChanged(LuaInfo *info);
 
@@ -59,9 +69,11 @@ public slots:
     void gameDirectoriesChanged();
     void fileChanged(const QString &path);
     void fileChangedTimeout();
+    void writeCache();
 
 private:
     LuaNode *loadLua(const QString &fileName);
+    void pruneCache();
 
 private:
     QMap<QString,LuaInfo*> mLuaInfo;
@@ -70,6 +82,9 @@ private:
     FileSystemWatcher mFileSystemWatcher;
     QSet<QString> mChangedFiles;
     QTimer mChangedFilesTimer;
+
+    LuaCache mCache;
+    QTimer mWriteCacheTimer;
 };
 
 inline LuaManager *luamgr() { return LuaManager::instance(); }
@@ -75,8 +75,6 @@ LuaModePerDocumentStuff::LuaModePerDocumentStuff(LuaMode *mode, LuaDocument *doc
     const int tabStop = 4;
     mEditor->setTabStopWidth(tabStop * metrics.width(QLatin1Char(' ')));
 
-    /*highlighter =*/ new Highlighter(mEditor->document());
-
     QFrame *frame = new QFrame;
     mWidget = frame;
     frame->setFrameShadow(mEditor->frameShadow());
@@ -98,7 +96,7 @@ LuaModePerDocumentStuff::LuaModePerDocumentStuff(LuaMode *mode, LuaDocument *doc
     vbox->addWidget(mEditor);
     mWidget->setLayout(vbox);
 
-    connect(mEditor, SIGNAL(syntaxError(QString)), SLOT(syntaxError(QString)));
+    connect(mEditor, SIGNAL(syntaxError(QString,int,int)), SLOT(syntaxError(QString,int,int)));
 
     doc->setEditor(mEditor); // a bit kludgey
 }
@@ -153,12 +151,17 @@ void LuaModePerDocumentStuff::updateDocumentTab()
     mMode->mTabWidget->setTabToolTip(tabIndex, tooltipText);
 }
 
-void LuaModePerDocumentStuff::syntaxError(const QString &error)
+void LuaModePerDocumentStuff::syntaxError(const QString &error, int line, int column)
 {
     if (error.isEmpty()) {
         mSyntaxLabel->setVisible(false);
     } else {
-        mSyntaxLabel->setText(error);
+        if (line > 0 && column > 0)
+            mSyntaxLabel->setText(tr("Line %1, column %2: %3").arg(line).arg(column).arg(error));
+        else if (line > 0)
+            mSyntaxLabel->setText(tr("Line %1: %2").arg(line).arg(error));
+        else
+            mSyntaxLabel->setText(error);
         mSyntaxLabel->setVisible(true);
     }
 }
@@ -57,7 +57,7 @@ public:
 
 public slots:
     void updateDocumentTab();
-    void syntaxError(const QString &error);
+    void syntaxError(const QString &error, int line, int column);
 
 protected:
     LuaMode *mMode;
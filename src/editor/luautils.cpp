@@ -1,5 +1,15 @@
 #include "luautils.h"
 
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QTemporaryFile>
+#include <QThread>
+
+#include <stdlib.h>
+#include <string.h>
+
 extern "C" {
 
 // see luaconf.h
@@ -15,13 +25,186 @@ void luai_writeline()
 } // extern "C"
 
 
-LuaState::LuaState()
+// Blocks up to REGION_MAX_SMALL bytes are rounded up to a multiple of
+// REGION_GRANULE and carved out of REGION_CHUNK_SIZE chunks.
+#define REGION_GRANULE 16
+#define REGION_MAX_SMALL 512
+#define REGION_CHUNK_SIZE (64 * 1024)
+#define REGION_CLASSES (REGION_MAX_SMALL / REGION_GRANULE)
+
+// The memory for one lua_State.  Freed small blocks go on a free list for
+// their size class and are reused by later allocations of that class, so
+// tables and strings don't each cost a malloc and a free.  The chunks are
+// only returned to the system when the region is destroyed.  Larger blocks
+// use malloc directly.  Only the thread using the state touches its region.
+class LuaRegion
 {
-    if (L = luaL_newstate()) {
-        luaL_openlibs(L);
+public:
+    LuaRegion() :
+        mInUse(0),
+        mPeak(0),
+        mReserved(0),
+        mBump(0),
+        mBumpEnd(0)
+    {
+        memset(mFree, 0, sizeof(mFree));
+    }
+
+    ~LuaRegion()
+    {
+        foreach (char *chunk, mChunks)
+            free(chunk);
+    }
+
+    static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+    void resetPeak() { mPeak = mInUse; }
+
+    size_t mInUse; // as requested by Lua, not rounded up
+    size_t mPeak;
+    size_t mReserved; // chunks and large blocks
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *mNext;
+    };
+
+    static int sizeClass(size_t size)
+    { return int((size + REGION_GRANULE - 1) / REGION_GRANULE) - 1; }
+
+    void *allocate(size_t size);
+    void release(void *ptr, size_t size);
+
+    FreeBlock *mFree[REGION_CLASSES];
+    char *mBump;
+    char *mBumpEnd;
+    QList<char*> mChunks;
+};
+
+void *LuaRegion::allocate(size_t size)
+{
+    if (size > REGION_MAX_SMALL) {
+        void *p = malloc(size);
+        if (p)
+            mReserved += size;
+        return p;
+    }
+
+    int sc = sizeClass(size);
+    if (FreeBlock *block = mFree[sc]) {
+        mFree[sc] = block->mNext;
+        return block;
+    }
+
+    size_t blockSize = (sc + 1) * REGION_GRANULE;
+    if (size_t(mBumpEnd - mBump) < blockSize) {
+        char *chunk = static_cast<char*>(malloc(REGION_CHUNK_SIZE));
+        if (!chunk)
+            return 0;
+        mChunks += chunk;
+        mReserved += REGION_CHUNK_SIZE;
+        mBump = chunk;
+        mBumpEnd = chunk + REGION_CHUNK_SIZE;
+    }
+    void *p = mBump;
+    mBump += blockSize;
+    return p;
+}
+
+void LuaRegion::release(void *ptr, size_t size)
+{
+    if (size > REGION_MAX_SMALL) {
+        free(ptr);
+        mReserved -= size;
+        return;
+    }
+    FreeBlock *block = static_cast<FreeBlock*>(ptr);
+    int sc = sizeClass(size);
+    block->mNext = mFree[sc];
+    mFree[sc] = block;
+}
+
+// A lua_Alloc.  When ptr is NULL, osize is the type of object being created
+// rather than a size.
+void *LuaRegion::alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    LuaRegion *region = static_cast<LuaRegion*>(ud);
+    if (!ptr)
+        osize = 0;
+
+    if (nsize == 0) {
+        if (ptr) {
+            region->release(ptr, osize);
+            region->mInUse -= osize;
+        }
+        return 0;
+    }
+
+    void *p;
+    if (ptr && osize <= REGION_MAX_SMALL && nsize <= REGION_MAX_SMALL &&
+            sizeClass(osize) == sizeClass(nsize)) {
+        p = ptr;
+    } else if (ptr && osize > REGION_MAX_SMALL && nsize > REGION_MAX_SMALL) {
+        p = realloc(ptr, nsize);
+        if (p) {
+            region->mReserved += nsize - osize;
+        } else {
+            // Lua requires shrinking to succeed.  The block keeps its old
+            // size, so mReserved overstates it a little once it is freed.
+            if (nsize > osize)
+                return 0;
+            p = ptr;
+        }
+    } else {
+        p = region->allocate(nsize);
+        if (p) {
+            if (ptr) {
+                memcpy(p, ptr, qMin(osize, nsize));
+                region->release(ptr, osize);
+            }
+        } else {
+            // Lua requires shrinking to succeed, so keep the old block.  It
+            // is released later as a block of the new size; a large block is
+            // then only freed along with the chunks.
+            if (!ptr || nsize > osize)
+                return 0;
+            if (osize > REGION_MAX_SMALL)
+                region->mChunks += static_cast<char*>(ptr);
+            p = ptr;
+        }
+    }
+
+    region->mInUse += nsize - osize;
+    if (region->mInUse > region->mPeak)
+        region->mPeak = region->mInUse;
+    return p;
+}
+
+/////
+
+static const char *KEY_SAVED_GLOBALS = "_SCRIPTED_GLOBALS_";
+
+// Same as the one luaL_newstate() installs.
+static int panic(lua_State *L)
+{
+    qWarning("PANIC: unprotected error in call to Lua API (%s)", lua_tostring(L, -1));
+    return 0;
+}
+
+LuaState::LuaState(Libraries libs, Allocator allocator) :
+    mLibraries(libs),
+    mRegion(allocator == RegionAllocator ? new LuaRegion : 0)
+{
+    L = mRegion ? lua_newstate(LuaRegion::alloc, mRegion) : luaL_newstate();
+    if (L) {
+        lua_atpanic(L, panic);
+        openLibraries();
 
         lua_pushboolean(L, true);
         lua_setglobal(L, "_SCRIPTED_");
+
+        saveGlobals();
     }
 }
 
@@ -29,17 +212,117 @@ LuaState::~LuaState()
 {
     if (L)
         lua_close(L);
+    delete mRegion;
+}
+
+qint64 LuaState::peakBytes() const
+{
+    return mRegion ? mRegion->mPeak : 0;
+}
+
+qint64 LuaState::reservedBytes() const
+{
+    return mRegion ? mRegion->mReserved : 0;
+}
+
+void LuaState::openLibraries()
+{
+    if (mLibraries == AllLibraries) {
+        luaL_openlibs(L);
+        return;
+    }
+
+    static const luaL_Reg libs[] = {
+        {"_G", luaopen_base},
+        {LUA_COLIBNAME, luaopen_coroutine},
+        {LUA_TABLIBNAME, luaopen_table},
+        {LUA_STRLIBNAME, luaopen_string},
+        {LUA_BITLIBNAME, luaopen_bit32},
+        {LUA_MATHLIBNAME, luaopen_math},
+        {NULL, NULL}
+    };
+    for (const luaL_Reg *lib = libs; lib->func; lib++) {
+        luaL_requiref(L, lib->name, lib->func, 1);
+        lua_pop(L, 1);
+    }
+
+    // The base library can still read files.
+    lua_pushnil(L);
+    lua_setglobal(L, "dofile");
+    lua_pushnil(L);
+    lua_setglobal(L, "loadfile");
+}
+
+// Remember the contents of the global table so reset() can restore it.
+void LuaState::saveGlobals()
+{
+    lua_pushglobaltable(L); // G
+    lua_newtable(L); // G saved
+    lua_pushnil(L); // space for key
+    while (lua_next(L, -3) != 0) { // G saved k v
+        lua_pushvalue(L, -2); // G saved k v k
+        lua_insert(L, -2); // G saved k k v
+        lua_rawset(L, -4); // G saved k
+    }
+    lua_setfield(L, LUA_REGISTRYINDEX, KEY_SAVED_GLOBALS); // G
+    lua_pop(L, 1);
+}
+
+void LuaState::reset()
+{
+    mFileName.clear();
+    mError.clear();
+    if (!L)
+        return;
+
+    lua_settop(L, 0);
+    lua_pushglobaltable(L); // 1
+    lua_getfield(L, LUA_REGISTRYINDEX, KEY_SAVED_GLOBALS); // 2
+
+    // Clear globals that were added.  Clearing existing fields during
+    // lua_next is allowed.
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) { // k v
+        lua_pop(L, 1); // k
+        lua_pushvalue(L, -1); // k k
+        lua_rawget(L, 2); // k saved[k]
+        bool added = lua_isnil(L, -1);
+        lua_pop(L, 1); // k
+        if (added) {
+            lua_pushvalue(L, -1); // k k
+            lua_pushnil(L); // k k nil
+            lua_rawset(L, 1); // k
+        }
+    }
+
+    // Restore globals that were reassigned or cleared.
+    lua_pushnil(L);
+    while (lua_next(L, 2) != 0) { // k v
+        lua_pushvalue(L, -2); // k v k
+        lua_insert(L, -2); // k k v
+        lua_rawset(L, 1); // k
+    }
+
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
 }
 
 bool LuaState::loadFile(const QString &fileName)
 {
-    int status = luaL_loadfile(L, fileName.toLatin1().data());
-    if (status != LUA_OK)
-        return false;
+    mFileName = fileName;
+    if (mRegion)
+        mRegion->resetPeak();
 
-    status = lua_pcall(L, 0, 0, -1);
-    if (status != LUA_OK)
+    int status = LuaBytecodeCache::isEnabled()
+            ? luaBytecodeCache()->load(L, fileName)
+            : luaL_loadfile(L, fileName.toLatin1().data());
+    if (status == LUA_OK)
+        status = lua_pcall(L, 0, 0, 0);
+    if (status != LUA_OK) {
+        mError = QLatin1String(lua_tostring(L, -1));
+        lua_pop(L, 1);
         return false;
+    }
 
     return true;
 }
@@ -56,88 +339,292 @@ bool LuaState::loadString(const QString &str, const QString &name)
     return true;
 }
 
-LuaValue LuaState::getGlobal(const QString &name)
+LuaCursor LuaState::global(const char *path)
 {
-    lua_getglobal(L, name.toLatin1().data());
-    LuaValue v = toValue(-1);
-    lua_pop(L, 1);
-    return v;
-}
-
-LuaValue LuaState::toValue(int stackIndex)
-{
-    if (stackIndex < 0)
-        stackIndex = lua_gettop(L) - qAbs(stackIndex) + 1;
-    LuaValue v;
-    v.mType = lua_type(L, stackIndex);
-    switch (v.mType) {
-    case LUA_TNONE:
-        break;
-    case LUA_TNIL:
-        break;
-    case LUA_TNUMBER:
-        v.mNumberValue = lua_tonumber(L, stackIndex);
-        break;
-    case LUA_TBOOLEAN:
-        v.mBooleanValue = lua_toboolean(L, stackIndex);
-        break;
-    case LUA_TSTRING:
-        v.mStringValue = QLatin1String(lua_tostring(L, stackIndex));
-        break;
-    case LUA_TTABLE:
-        v.mTableValue = toTableValue(stackIndex);
-        break;
-    }
-    return v;
-}
-
-LuaTableValue LuaState::toTableValue(int stackIndex)
-{
-    if (stackIndex < 0)
-        stackIndex = lua_gettop(L) - qAbs(stackIndex) + 1;
-    LuaTableValue tv;
-    if (!lua_istable(L, stackIndex))
-        return tv;
-    lua_pushnil(L); // space for key
-    while (lua_next(L, stackIndex) != 0) { // pop a key, push next key, push next value
-        tv.mKeys += new LuaValue(toValue(-2));
-        tv.mValues += new LuaValue(toValue(-1));
-        lua_pop(L, 1); // pop value
+    if (!L || !lua_checkstack(L, 2))
+        return LuaCursor();
+    lua_pushglobaltable(L);
+    return LuaCursor(L, lua_gettop(L)).field(path);
+}
+
+/////
+
+LuaCursor::LuaCursor(lua_State *state, int stackIndex) :
+    L(state),
+    mIndex(stackIndex)
+{
+    if (mIndex < 0)
+        mIndex = lua_gettop(L) + mIndex + 1;
+}
+
+int LuaCursor::type() const
+{
+    return mIndex ? lua_type(L, mIndex) : LUA_TNONE;
+}
+
+bool LuaCursor::isString(const char *v) const
+{
+    if (type() != LUA_TSTRING)
+        return false;
+    size_t len;
+    const char *s = lua_tolstring(L, mIndex, &len);
+    return len == qstrlen(v) && !memcmp(s, v, len);
+}
+
+QString LuaCursor::toString() const
+{
+    // lua_tostring() would convert a number in place, which confuses
+    // lua_next() when the number is a key.
+    switch (type())
+    {
+    case LUA_TNUMBER: return QString::number(lua_tonumber(L, mIndex));
+    case LUA_TBOOLEAN: return QLatin1String(lua_toboolean(L, mIndex) ? "true" : "false");
+    case LUA_TSTRING: {
+        size_t len;
+        const char *s = lua_tolstring(L, mIndex, &len);
+        return QString::fromLatin1(s, int(len));
+    }
+    }
+    return QString();
+}
+
+LuaCursor LuaCursor::field(const char *path) const
+{
+    if (!mIndex || !lua_checkstack(L, 2))
+        return LuaCursor();
+    lua_pushvalue(L, mIndex);
+    const char *key = path;
+    while (*key) {
+        const char *dot = strchr(key, '.');
+        size_t len = dot ? size_t(dot - key) : strlen(key);
+        if (lua_istable(L, -1)) {
+            lua_pushlstring(L, key, len);
+            lua_rawget(L, -2);
+        } else
+            lua_pushnil(L);
+        lua_replace(L, -2);
+        if (!dot)
+            break;
+        key = dot + 1;
     }
-    return tv;
+    return LuaCursor(L, lua_gettop(L));
+}
+
+/////
+
+LuaTableIterator::LuaTableIterator(const LuaCursor &table) :
+    L(0),
+    mTable(0),
+    mBase(0),
+    mKeyIndex(0),
+    mDone(true)
+{
+    if (table.isTable() && lua_checkstack(table.L, 3)) {
+        L = table.L;
+        mTable = table.mIndex;
+        mBase = lua_gettop(L);
+        lua_pushnil(L); // space for key
+        mKeyIndex = lua_gettop(L);
+        mDone = false;
+    }
+}
+
+LuaTableIterator::~LuaTableIterator()
+{
+    if (L)
+        lua_settop(L, mBase);
+}
+
+bool LuaTableIterator::next()
+{
+    if (mDone)
+        return false;
+    lua_settop(L, mKeyIndex); // pop the value and anything pushed since
+    if (lua_next(L, mTable) == 0) { // pop a key, push next key, push next value
+        mDone = true;
+        return false;
+    }
+    return true;
+}
+
+LuaCursor LuaTableIterator::key() const
+{
+    return mDone ? LuaCursor() : LuaCursor(L, mKeyIndex);
+}
+
+LuaCursor LuaTableIterator::value() const
+{
+    return mDone ? LuaCursor() : LuaCursor(L, mKeyIndex + 1);
 }
 
 /////
 
-LuaTableValue::LuaTableValue(const LuaTableValue &other)
+SINGLETON_IMPL(LuaBytecodeCache)
+
+LuaBytecodeCache::LuaBytecodeCache(const QString &directory) :
+    mDirectory(directory),
+    mHits(0),
+    mMisses(0)
 {
-    foreach (LuaValue *v, other.mKeys)
-        mKeys += new LuaValue(*v);
-    foreach (LuaValue *v, other.mValues)
-        mValues += new LuaValue(*v);
 }
 
-LuaTableValue &LuaTableValue::operator=(const LuaTableValue &other)
+static int appendChunk(lua_State *L, const void *p, size_t sz, void *ud)
 {
-    foreach (LuaValue *v, other.mKeys)
-        mKeys += new LuaValue(*v);
-    foreach (LuaValue *v, other.mValues)
-        mValues += new LuaValue(*v);
-    return *this;
+    Q_UNUSED(L)
+    static_cast<QByteArray*>(ud)->append(static_cast<const char*>(p), int(sz));
+    return 0;
 }
 
-LuaTableValue::LuaTableValue()
+int LuaBytecodeCache::load(lua_State *L, const QString &fileName)
 {
+    QByteArray chunkName = "@" + fileName.toLatin1(); // same as luaL_loadfile
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        lua_pushfstring(L, "cannot open %s", chunkName.constData() + 1);
+        return LUA_ERRFILE;
+    }
+    QByteArray source = file.readAll();
+    file.close();
+
+    // Each source file has one cache file, named after the chunk name, so an
+    // edited file replaces its old chunk instead of adding another one.  The
+    // cache file starts with a hash of the source it was compiled from.
+    QString cachePath = mDirectory + QLatin1Char('/') +
+            QString::fromLatin1(QCryptographicHash::hash(chunkName, QCryptographicHash::Md5).toHex()) +
+            QLatin1String(".luac");
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(QByteArray(LUA_RELEASE));
+    hash.addData(source);
+    QByteArray sourceHash = hash.result();
+
+    QFile cached(cachePath);
+    if (cached.open(QFile::ReadOnly)) {
+        QByteArray bytecode = cached.readAll();
+        cached.close();
+        // lundump checks the header, so a chunk written by a build with
+        // different type sizes fails here and is replaced.
+        if (bytecode.startsWith(sourceHash)) {
+            if (luaL_loadbufferx(L, bytecode.constData() + sourceHash.size(),
+                                 bytecode.size() - sourceHash.size(),
+                                 chunkName.constData(), "b") == LUA_OK) {
+                QMutexLocker locker(&mMutex);
+                ++mHits;
+                return LUA_OK;
+            }
+            lua_pop(L, 1);
+        }
+    }
+
+    {
+        QMutexLocker locker(&mMutex);
+        ++mMisses;
+    }
+
+    // luaL_loadfile skips a UTF-8 BOM and then a first line starting with
+    // '#'.  Keep its newline so line numbers are unchanged, unless a
+    // precompiled chunk follows it.
+    if (source.startsWith("\xEF\xBB\xBF"))
+        source.remove(0, 3);
+    if (source.startsWith('#')) {
+        int eol = source.indexOf('\n');
+        source = (eol == -1) ? QByteArray() : source.mid(eol);
+        if (source.startsWith("\n" LUA_SIGNATURE))
+            source.remove(0, 1);
+    }
+    int status = luaL_loadbufferx(L, source.constData(), source.size(),
+                                  chunkName.constData(), "bt");
+    if (status != LUA_OK)
+        return status;
+
+    QByteArray bytecode = sourceHash;
+    if (lua_dump(L, appendChunk, &bytecode) != 0)
+        return LUA_OK;
 
+    // Another thread may be loading the same file, so the chunk is written
+    // to a temporary file that is then renamed.
+    QDir().mkpath(mDirectory);
+    QTemporaryFile temp(cachePath + QLatin1String(".XXXXXX"));
+    temp.setAutoRemove(false);
+    if (temp.open()) {
+        bool ok = temp.write(bytecode) == bytecode.size();
+        temp.close();
+        // QFile::rename() won't overwrite, and the existing chunk is stale.
+        QFile::remove(cachePath);
+        if (!ok || !temp.rename(cachePath))
+            QFile::remove(temp.fileName());
+    }
+
+    return LUA_OK;
+}
+
+int LuaBytecodeCache::hits()
+{
+    QMutexLocker locker(&mMutex);
+    return mHits;
 }
 
-QMap<QString, QString> LuaTableValue::toStringStringMap()
+int LuaBytecodeCache::misses()
 {
-    QMap<QString,QString> ret;
-    for (int i = 0; i < size(); i++) {
-        LuaValue *k = mKeys[i];
-        LuaValue *v = mValues[i];
-        ret[k->toString()] = v->toString();
+    QMutexLocker locker(&mMutex);
+    return mMisses;
+}
+
+/////
+
+SINGLETON_IMPL(LuaStatePool)
+
+LuaStatePool::LuaStatePool() :
+    mMaxStates(qMax(QThread::idealThreadCount(), 1) * 2)
+{
+}
+
+LuaStatePool::~LuaStatePool()
+{
+    qDeleteAll(mStates[LuaState::AllLibraries]);
+    qDeleteAll(mStates[LuaState::SandboxLibraries]);
+}
+
+LuaState *LuaStatePool::acquire(LuaState::Libraries libs)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        if (!mStates[libs].isEmpty())
+            return mStates[libs].takeLast();
+    }
+    return new LuaState(libs, LuaState::RegionAllocator);
+}
+
+// A state that needed more than this for some file is deleted rather than
+// kept around holding on to all that memory.
+#define POOLED_STATE_MAX_BYTES (4 * 1024 * 1024)
+
+void LuaStatePool::release(LuaState *state)
+{
+    if (!state->isValid()) {
+        delete state;
+        return;
+    }
+
+    if (!state->fileName().isEmpty()) {
+        QMutexLocker locker(&mMutex);
+        qint64 &peak = mPeakBytes[state->fileName()];
+        peak = qMax(peak, state->peakBytes());
+    }
+
+    state->reset();
+
+    QMutexLocker locker(&mMutex);
+    QList<LuaState*> &states = mStates[state->libraries()];
+    if (states.size() < mMaxStates && state->reservedBytes() <= POOLED_STATE_MAX_BYTES)
+        states += state;
+    else {
+        locker.unlock();
+        delete state;
     }
-    return ret;
+}
+
+QMap<QString,qint64> LuaStatePool::peakBytes()
+{
+    QMutexLocker locker(&mMutex);
+    return mPeakBytes;
 }
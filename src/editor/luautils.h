@@ -1,8 +1,11 @@
 #ifndef LUAUTILS_H
 #define LUAUTILS_H
 
+#include "singleton.h"
+
 #include <QList>
 #include <QMap>
+#include <QMutex>
 #include <QString>
 
 extern "C" {
@@ -12,91 +15,213 @@ extern "C" {
 
 }
 
-class LuaValue;
-
-class LuaTableValue
+// A value on the Lua stack of a LuaState, read in place.  A cursor doesn't
+// own its stack slot: values pushed by field() stay on the stack until the
+// enclosing LuaTableIterator advances or a LuaStackGuard goes out of scope.
+// Tables are only accessed raw, so no metamethods run.
+class LuaCursor
 {
 public:
-    LuaTableValue();
-    LuaTableValue(const LuaTableValue &other);
-    LuaTableValue &operator=(const LuaTableValue &other);
-
-    ~LuaTableValue()
+    LuaCursor() :
+        L(0),
+        mIndex(0)
     {
-        qDeleteAll(mKeys);
-        qDeleteAll(mValues);
     }
 
-    int size() const { return mKeys.size(); }
-    QMap<QString,QString> toStringStringMap();
+    LuaCursor(lua_State *state, int stackIndex);
+
+    int type() const;
+    bool isTable() const { return type() == LUA_TTABLE; }
+    bool isString(const char *v) const;
+    QString toString() const;
+
+    // Pushes the value at a key path like "inputs" or "a.b.c".
+    LuaCursor field(const char *path) const;
 
-    QList<LuaValue*> mKeys;
-    QList<LuaValue*> mValues;
+private:
+    lua_State *L;
+    int mIndex; // absolute, 0 if invalid
+
+    friend class LuaTableIterator;
 };
 
-class LuaValue
+// Iterates over a table with lua_next.  Everything pushed while visiting an
+// entry is popped by the following next().
+class LuaTableIterator
 {
 public:
-    LuaValue() :
-        mType(LUA_TNONE)
-    {
-    }
-#if 0
-    LuaValue(const LuaValue &other) :
-        mType(other.mType),
-        mNumberValue(other.mNumberValue),
-        mStringValue(other.mStringValue),
-        mBooleanValue(other.mBooleanValue),
-        mTableValue(other.mTableValue)
-    {
-    }
-#endif
-    int type() const { return mType; }
+    LuaTableIterator(const LuaCursor &table);
+    ~LuaTableIterator();
 
-    bool isString(const QString &v) const
-    { return mType == LUA_TSTRING && mStringValue == v; }
+    bool next();
+    LuaCursor key() const;
+    LuaCursor value() const;
 
-    QString toString() const
-    {
-        switch (mType)
-        {
-        case LUA_TNONE: return QString();
-        case LUA_TNIL: return QString();
-        case LUA_TNUMBER: return QString::number(mNumberValue);
-        case LUA_TBOOLEAN: return QLatin1String(mBooleanValue ? "true" : "false");
-        case LUA_TSTRING: return mStringValue;
-        case LUA_TTABLE: return QString();
-        }
-        return QString();
-    }
-
-    bool isTable() const
-    { return mType == LUA_TTABLE; }
-
-    int mType; // LUA_TNONE, LUA_TNIL, etc
-    double mNumberValue;
-    QString mStringValue;
-    bool mBooleanValue;
-    LuaTableValue mTableValue;
+private:
+    lua_State *L;
+    int mTable;
+    int mBase;
+    int mKeyIndex;
+    bool mDone;
+    Q_DISABLE_COPY(LuaTableIterator)
 };
 
+class LuaRegion;
+
 class LuaState
 {
 public:
-    LuaState();
+    enum Libraries {
+        AllLibraries,
+        // No io, os, package or debug, and no dofile/loadfile.  Enough for
+        // the metadata files, which only build tables.
+        SandboxLibraries
+    };
+
+    enum Allocator {
+        SystemAllocator,
+        // Small blocks come from a LuaRegion owned by the state, which also
+        // keeps track of the memory in use.
+        RegionAllocator
+    };
+
+    LuaState(Libraries libs = AllLibraries, Allocator allocator = SystemAllocator);
     ~LuaState();
 
+    bool isValid() const { return L != 0; }
+    Libraries libraries() const { return mLibraries; }
+
+    // The file last run by loadFile(), cleared by reset().
+    QString fileName() const { return mFileName; }
+
+    // The most memory in use since loadFile() was last called, only known
+    // with RegionAllocator.
+    qint64 peakBytes() const;
+
+    // Memory held by the state's region, whether in use or not.
+    qint64 reservedBytes() const;
+
     bool loadFile(const QString &fileName);
     bool loadString(const QString &str, const QString &name);
-    LuaValue getGlobal(const QString &name);
-    LuaValue toValue(int stackIndex);
-    LuaTableValue toTableValue(int stackIndex);
+    // Pushes the global at a key path like "editor" or "editor.inputs".
+    LuaCursor global(const char *path);
+
+    lua_State *state() const { return L; }
+
+    void reset();
 
     QString errorString() { return mError; }
 
 private:
+    void openLibraries();
+    void saveGlobals();
+
     lua_State *L;
+    Libraries mLibraries;
+    LuaRegion *mRegion;
+    QString mFileName;
     QString mError;
 };
 
+// Restores the Lua stack to its size at construction.
+class LuaStackGuard
+{
+public:
+    LuaStackGuard(LuaState &state) :
+        L(state.state()),
+        mTop(L ? lua_gettop(L) : 0)
+    {
+    }
+
+    ~LuaStackGuard()
+    {
+        if (L)
+            lua_settop(L, mTop);
+    }
+
+private:
+    lua_State *L;
+    int mTop;
+    Q_DISABLE_COPY(LuaStackGuard)
+};
+
+// Keeps initialized LuaStates around so they don't have to be created for
+// every file.  A state's global table is restored to what it was after the
+// libraries were opened when it is returned to the pool.  Library tables
+// themselves aren't restored, so the pool should only be used for code that
+// doesn't modify them (the metadata files, syntax checking).
+// acquire() and release() may be called from any thread.
+// The pooled states use LuaState::RegionAllocator.  The peak memory use of
+// each file they run is recorded when they are released.
+class LuaStatePool : public Singleton<LuaStatePool>
+{
+public:
+    LuaStatePool();
+    ~LuaStatePool();
+
+    LuaState *acquire(LuaState::Libraries libs = LuaState::SandboxLibraries);
+    void release(LuaState *state);
+
+    // File name -> the most memory used while running it.
+    QMap<QString,qint64> peakBytes();
+
+private:
+    QMutex mMutex;
+    QList<LuaState*> mStates[2]; // indexed by LuaState::Libraries
+    int mMaxStates;
+    QMap<QString,qint64> mPeakBytes;
+};
+
+inline LuaStatePool *luaStatePool() { return LuaStatePool::instance(); }
+
+// Compiled chunks of the files run by LuaState::loadFile(), so unchanged files
+// aren't lexed and parsed again.  Each chunk is stored in a file named after
+// a hash of the chunk name, preceded by a hash of the Lua version and the
+// source.  A stale chunk is overwritten when its file is next loaded.
+// load() may be called from any thread.
+class LuaBytecodeCache : public Singleton<LuaBytecodeCache>
+{
+public:
+    LuaBytecodeCache(const QString &directory);
+
+    // LuaState::loadFile() parses the source as usual without a cache.
+    static bool isEnabled() { return mInstance != 0; }
+
+    // Like luaL_loadfile().
+    int load(lua_State *L, const QString &fileName);
+
+    int hits();
+    int misses();
+
+private:
+    QString mDirectory;
+    QMutex mMutex;
+    int mHits;
+    int mMisses;
+};
+
+inline LuaBytecodeCache *luaBytecodeCache() { return LuaBytecodeCache::instance(); }
+
+// Borrows a LuaState from the pool for the lifetime of this object.
+class PooledLuaState
+{
+public:
+    PooledLuaState(LuaState::Libraries libs = LuaState::SandboxLibraries) :
+        mState(luaStatePool()->acquire(libs))
+    {
+    }
+
+    ~PooledLuaState()
+    {
+        luaStatePool()->release(mState);
+    }
+
+    LuaState *operator->() const { return mState; }
+    LuaState &operator*() const { return *mState; }
+
+private:
+    LuaState *mState;
+    Q_DISABLE_COPY(PooledLuaState)
+};
+
 #endif // LUAUTILS_H
@@ -20,11 +20,52 @@
 
 #include "documentmanager.h"
 #include "luamanager.h"
+#include "luautils.h"
 #include "metaeventmanager.h"
 #include "node.h"
 #include "preferences.h"
 #include "progress.h"
+#include "project.h"
+#include "projectreader.h"
+#include "projectwriter.h"
 #include "scriptmanager.h"
+#include "symboltable.h"
+
+#include <QDebug>
+
+// Converts a script between the XML (.pzs) and binary (.pzsb) formats, the
+// format written is chosen by the extension of the output file.
+static int convertProject(const QString &inPath, const QString &outPath)
+{
+    ProjectReader reader;
+    Project *project = reader.read(inPath);
+    if (!project) {
+        qWarning() << "Error reading" << inPath << ":" << reader.errorString();
+        return 1;
+    }
+
+    ProjectWriter writer;
+    bool ok = writer.write(project, outPath);
+    if (!ok)
+        qWarning() << "Error writing" << outPath << ":" << writer.errorString();
+    delete project;
+    return ok ? 0 : 1;
+}
+
+// Prints how much memory sharing the name strings saves for a script.
+static int memoryReport(const QString &path)
+{
+    ProjectReader reader;
+    Project *project = reader.read(path);
+    if (!project) {
+        qWarning() << "Error reading" << path << ":" << reader.errorString();
+        return 1;
+    }
+
+    qWarning("%s", qPrintable(SymbolTable::memoryReport(project)));
+    delete project;
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,7 +85,15 @@ int main(int argc, char *argv[])
 
     qRegisterMetaType<BaseNode*>("BaseNode*");
 
+    QStringList args = a.arguments();
+    if (args.size() == 4 && args[1] == QLatin1String("--convert"))
+        return convertProject(args[2], args[3]);
+    if (args.size() == 3 && args[1] == QLatin1String("--memory-report"))
+        return memoryReport(args[2]);
+
     new Preferences;
+    new LuaStatePool;
+    new LuaBytecodeCache(prefs()->configPath(QLatin1String("scripted-luac")));
     new DocumentManager;
     new ScriptManager;
 
@@ -62,5 +111,9 @@ int main(int argc, char *argv[])
 
     w.openLastFiles();
 
-    return a.exec();
+    int ret = a.exec();
+
+    luamgr()->writeCache();
+
+    return ret;
 }
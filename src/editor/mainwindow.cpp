@@ -189,10 +189,10 @@ void MainWindow::openLastFiles()
         }
     }
 
+    // Scripts are still being read, the last active one is made current
+    // when it arrives.
     QString lastActiveDocument = mSettings.value(QLatin1String("lastActive")).toString();
-    int documentIndex = docman()->findDocument(lastActiveDocument);
-    if (documentIndex != -1)
-        docman()->setCurrentDocument(documentIndex);
+    ProjectActions::instance()->setCurrentDocumentLater(lastActiveDocument);
 
     mSettings.endGroup();
 }
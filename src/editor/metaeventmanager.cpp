@@ -17,11 +17,12 @@
 
 #include "metaeventmanager.h"
 
+#include "luafileloader.h"
 #include "luautils.h"
 #include "node.h"
 #include "preferences.h"
 
-#include <QApplication>
+#include <QCoreApplication>
 #include <QDir>
 #include <QFileInfo>
 
@@ -84,6 +85,7 @@ bool MetaEventManager::readEventFiles()
 {
     QStringList filters;
     filters << QLatin1String("MetaEvents.lua");
+    QStringList fileNames;
     foreach (QString path, prefs()->gameDirectories()) {
         QDir dir = QDir(path).filePath(QLatin1String("media/lua/MetaGame"));
         if (!dir.exists()) {
@@ -92,49 +94,68 @@ bool MetaEventManager::readEventFiles()
         }
         foreach (QFileInfo fileInfo, dir.entryInfoList(filters)) {
             QString fileName = fileInfo.canonicalFilePath();
-            readEventFile(fileName);
+            if (!fileNames.contains(fileName))
+                fileNames += fileName;
         }
     }
+
+    LuaFileLoader loader;
+    loader.setThreadCount(prefs()->loaderThreadCount());
+    loader.setProgressText(tr("Reading event files (%1/%2)"));
+    foreach (const LuaFileLoader::EventResult &result, loader.readEventFiles(fileNames))
+        mergeEventFile(result.mPath, result.mOK, result.mNodes);
+
     return true;
 }
 
 bool MetaEventManager::readEventFile(const QString &fileName)
+{
+    MetaEventFile file;
+    bool ok = file.read(fileName);
+    return mergeEventFile(fileName, ok, file.takeNodes());
+}
+
+// Takes ownership of the nodes.
+bool MetaEventManager::mergeEventFile(const QString &fileName, bool ok,
+                                      const QList<MetaEventNode *> &nodes)
 {
     QMap<QString,MetaEventInfo*> oldEvents = mEventsByFile[fileName];
     QMap<QString,MetaEventInfo*> &newEvents = mEventsByFile[fileName];
 //    newEvents.clear();
 
-    bool ok = false;
-
-    if (QFileInfo(fileName).exists()) {
-
+    if (!QFileInfo(fileName).exists())
+        ok = false;
+    else {
         // Watch the file even if it fails to load
         mFileSystemWatcher.addPath(fileName);
+    }
 
-        MetaEventFile file;
-        if (file.read(fileName)) {
-            foreach (MetaEventNode *node, file.takeNodes()) {
-                MetaEventInfo *info;
-                if (oldEvents.contains(node->eventName())) {
-                    info = oldEvents[node->eventName()];
-                    delete info->node();
-                    oldEvents.remove(node->eventName());
-                } else {
-                    info = new MetaEventInfo;
-                }
-                info->mNode = node;
-                info->mPath = fileName;
-                info->mEventName = node->eventName();
-                node->setInfo(info);
-                newEvents[info->eventName()] = info;
+    if (ok) {
+        QList<MetaEventInfo*> changed;
+        foreach (MetaEventNode *node, nodes) {
+            MetaEventInfo *info;
+            if (oldEvents.contains(node->eventName())) {
+                info = oldEvents[node->eventName()];
+                // Event nodes only need syncing if the variables changed.
+                if (!node->sameSignature(info->node()))
+                    changed += info;
+                delete info->node();
+                oldEvents.remove(node->eventName());
+            } else {
+                info = new MetaEventInfo;
+                changed += info;
             }
-
-            foreach (MetaEventInfo *info, newEvents)
-                emit infoChanged(info);
-
-            ok = true;
+            info->mNode = node;
+            info->mPath = fileName;
+            info->mEventName = node->eventName();
+            node->setInfo(info);
+            newEvents[info->eventName()] = info;
         }
-    }
+
+        foreach (MetaEventInfo *info, changed)
+            emit infoChanged(info);
+    } else
+        qDeleteAll(nodes);
 
     // Handle events that were in this file but aren't anymore.
     // This also handles a file being deleted.
@@ -193,43 +214,42 @@ bool MetaEventFile::read(const QString &fileName)
     if (!QFileInfo(fileName).exists())
         return false;
 
-    LuaState L;
-    if (!L.loadFile(fileName))
+    PooledLuaState L;
+    if (!L->loadFile(fileName))
         return false;
 
-    LuaValue lv = L.getGlobal(QLatin1String("events"));
-    if (lv.type() != LUA_TTABLE)
+    LuaStackGuard guard(*L);
+    LuaCursor events = L->global("events");
+    if (!events.isTable())
         return false;
 
-    LuaNode node(0, QFileInfo(fileName).baseName());
-
     QStringList eventNames;
 
-    for (int i = 0; i < lv.mTableValue.size(); i++) {
-//        LuaValue *k = lv.mTableValue.mKeys[i];
-        LuaValue *v = lv.mTableValue.mValues[i];
-        if (!v->isTable()) return false;
+    LuaTableIterator it(events);
+    while (it.next()) {
+        LuaCursor v = it.value();
+        if (!v.isTable()) return false;
         MetaEventNode node(0, QString(), QString());
-        for (int j = 0; j < v->mTableValue.size(); j++) {
-            LuaValue *k2 = v->mTableValue.mKeys[j];
-            LuaValue *v2 = v->mTableValue.mValues[j];
-            if (k2->isString(QLatin1String("name"))) {
-                if (v2->mType != LUA_TSTRING) return false;
-                node.setEventName(v2->toString());
-                node.setLabel(v2->toString());
+        LuaTableIterator it2(v);
+        while (it2.next()) {
+            LuaCursor k2 = it2.key();
+            LuaCursor v2 = it2.value();
+            if (k2.isString("name")) {
+                if (v2.type() != LUA_TSTRING) return false;
+                node.setEventName(v2.toString());
+                node.setLabel(v2.toString());
             }
-            if (k2->isString(QLatin1String("variables"))) {
-                if (!v2->isTable()) return false;
-                for (int m = 0; m < v2->mTableValue.size(); m++) {
-//                    LuaValue *k3 = v2->mTableValue.mKeys[m];
-                    LuaValue *v3 = v2->mTableValue.mValues[m];
-                    if (!v3->isTable()) return false;
-                    QMap<QString,QString> ssm = v3->mTableValue.toStringStringMap();
-                    QString name = ssm[QLatin1String("name")];
-                    QString type = ssm[QLatin1String("type")];
-                    QString label = ssm[QLatin1String("label")];
+            if (k2.isString("variables")) {
+                if (!v2.isTable()) return false;
+                LuaTableIterator it3(v2);
+                while (it3.next()) {
+                    LuaCursor v3 = it3.value();
+                    if (!v3.isTable()) return false;
+                    QString name = v3.field("name").toString();
+                    QString type = v3.field("type").toString();
+                    QString label = v3.field("label").toString();
                     if (label.isEmpty()) label = name;
-                    QString value = ssm[QLatin1String("value")];
+                    QString value = v3.field("value").toString();
                     node.insertVariable(node.variableCount(), new ScriptVariable(type, name, label, value));
                 }
             }
@@ -241,7 +261,7 @@ bool MetaEventFile::read(const QString &fileName)
         mNodes += new MetaEventNode(0, node);
     }
 
-    return new LuaNode(0, node);
+    return true;
 }
 
 QList<MetaEventNode *> MetaEventFile::takeNodes()
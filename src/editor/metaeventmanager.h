@@ -69,6 +69,7 @@ signals:
 
 private:
     bool readEventFile(const QString &fileName);
+    bool mergeEventFile(const QString &fileName, bool ok, const QList<MetaEventNode*> &nodes);
 
 public slots:
     void gameDirectoriesChanged();
@@ -65,6 +65,42 @@ bool NodeOutput::hasBadConnections()
 
 /////
 
+// The name indexes map a name to the first item in the list with that name,
+// which is what the linear searches they replaced returned.
+
+template <class T>
+static void indexInsert(QHash<QString,T*> &index, const QList<T*> &items, T *item)
+{
+    T *first = index.value(item->name());
+    if (!first || items.indexOf(item) < items.indexOf(first))
+        index[item->name()] = item;
+}
+
+template <class T>
+static void indexRemove(QHash<QString,T*> &index, const QList<T*> &items, T *item,
+                        const QString &name)
+{
+    if (index.value(name) != item)
+        return;
+    index.remove(name);
+    foreach (T *other, items) {
+        if (other != item && other->name() == name) {
+            index[name] = other;
+            break;
+        }
+    }
+}
+
+template <class T>
+static void indexRebuild(QHash<QString,T*> &index, const QList<T*> &items)
+{
+    index.clear();
+    for (int i = items.size() - 1; i >= 0; --i)
+        index[items[i]->name()] = items[i];
+}
+
+/////
+
 BaseNode::~BaseNode()
 {
     qDeleteAll(mInputs);
@@ -72,17 +108,29 @@ BaseNode::~BaseNode()
     qDeleteAll(mVariables);
 }
 
+void BaseNode::setID(int id)
+{
+    if (mParentNode) {
+        mParentNode->mNodeByID.remove(mID);
+        mParentNode->mNodeByID[id] = this;
+    }
+    mID = id;
+}
+
 void BaseNode::insertInput(int index, NodeInput *input)
 {
     Q_ASSERT(input->node() == NULL);
     input->setNode(this);
     mInputs.insert(index, input);
+    indexInsert(mInputByName, mInputs, input);
 }
 
 NodeInput *BaseNode::removeInput(int index)
 {
-    mInputs[index]->setNode(NULL);
-    return mInputs.takeAt(index);
+    NodeInput *input = mInputs.takeAt(index);
+    input->setNode(NULL);
+    indexRemove(mInputByName, mInputs, input, input->name());
+    return input;
 }
 
 void BaseNode::insertOutput(int index, NodeOutput *output)
@@ -90,18 +138,23 @@ void BaseNode::insertOutput(int index, NodeOutput *output)
     Q_ASSERT(output->node() == NULL);
     output->setNode(this);
     mOutputs.insert(index, output);
+    indexInsert(mOutputByName, mOutputs, output);
 }
 
 NodeOutput *BaseNode::removeOutput(int index)
 {
-    mOutputs[index]->setNode(NULL);
-    return mOutputs.takeAt(index);
+    NodeOutput *output = mOutputs.takeAt(index);
+    output->setNode(NULL);
+    indexRemove(mOutputByName, mOutputs, output, output->name());
+    return output;
 }
 
 void BaseNode::insertConnection(int index, NodeConnection *cxn)
 {
     Q_ASSERT(cxn->mSender == this);
     Q_ASSERT(!mConnections.contains(cxn));
+    cxn->mOutput = symbol(cxn->mOutput);
+    cxn->mInput = symbol(cxn->mInput);
     mConnections.insert(index, cxn);
 }
 
@@ -113,20 +166,13 @@ NodeConnection *BaseNode::removeConnection(NodeConnection *cxn)
     return mConnections.takeAt(index);
 }
 
-ScriptVariable *BaseNode::variable(const QString &name)
-{
-    foreach (ScriptVariable *p, mVariables)
-        if (p->name() == name)
-            return p;
-    return 0;
-}
-
 void BaseNode::insertVariable(int index, ScriptVariable *var)
 {
     Q_ASSERT(var->node() == NULL);
     Q_ASSERT(!mVariables.contains(var));
     var->setNode(this);
     mVariables.insert(index, var);
+    indexInsert(mVariableByName, mVariables, var);
 }
 
 ScriptVariable *BaseNode::removeVariable(ScriptVariable *var)
@@ -134,7 +180,37 @@ ScriptVariable *BaseNode::removeVariable(ScriptVariable *var)
     int index = mVariables.indexOf(var);
     Q_ASSERT(index != -1);
     var->setNode(NULL);
-    return mVariables.takeAt(index);
+    mVariables.takeAt(index);
+    indexRemove(mVariableByName, mVariables, var, var->name());
+    return var;
+}
+
+void BaseNode::inputNameChanged(NodeInput *input, const QString &oldName)
+{
+    Q_ASSERT(mInputs.contains(input));
+    indexRemove(mInputByName, mInputs, input, oldName);
+    indexInsert(mInputByName, mInputs, input);
+}
+
+void BaseNode::outputNameChanged(NodeOutput *output, const QString &oldName)
+{
+    Q_ASSERT(mOutputs.contains(output));
+    indexRemove(mOutputByName, mOutputs, output, oldName);
+    indexInsert(mOutputByName, mOutputs, output);
+}
+
+void BaseNode::variableNameChanged(ScriptVariable *var, const QString &oldName)
+{
+    Q_ASSERT(mVariables.contains(var));
+    indexRemove(mVariableByName, mVariables, var, oldName);
+    indexInsert(mVariableByName, mVariables, var);
+}
+
+void BaseNode::rebuildNameIndex()
+{
+    indexRebuild(mInputByName, mInputs);
+    indexRebuild(mOutputByName, mOutputs);
+    indexRebuild(mVariableByName, mVariables);
 }
 
 void BaseNode::initFrom(const BaseNode *other)
@@ -143,16 +219,19 @@ void BaseNode::initFrom(const BaseNode *other)
 
     qDeleteAll(mVariables);
     mVariables.clear();
+    mVariableByName.clear();
     foreach (ScriptVariable *var, other->mVariables)
         insertVariable(variableCount(), new ScriptVariable(var, 0));
 
     qDeleteAll(mInputs);
     mInputs.clear();
+    mInputByName.clear();
     foreach (NodeInput *input, other->mInputs)
         insertInput(inputCount(), new NodeInput(input));
 
     qDeleteAll(mOutputs);
     mOutputs.clear();
+    mOutputByName.clear();
     foreach (NodeOutput *output, other->mOutputs)
         insertOutput(outputCount(), new NodeOutput(output));
 #if 0
@@ -245,9 +324,40 @@ bool BaseNode::syncWithInfo(BaseNode *infoNode)
         changed = true;
     }
 
+    if (changed)
+        rebuildNameIndex();
+
     return changed;
 }
 
+bool BaseNode::sameSignature(BaseNode *other)
+{
+    if (!other)
+        return false;
+    if (mVariables.size() != other->mVariables.size()
+            || mInputs.size() != other->mInputs.size()
+            || mOutputs.size() != other->mOutputs.size())
+        return false;
+
+    for (int i = 0; i < mVariables.size(); i++) {
+        ScriptVariable *var = mVariables[i], *otherVar = other->mVariables[i];
+        if (var->name() != otherVar->name() || var->type() != otherVar->type()
+                || var->label() != otherVar->label())
+            return false;
+    }
+    for (int i = 0; i < mInputs.size(); i++) {
+        if (mInputs[i]->name() != other->mInputs[i]->name()
+                || mInputs[i]->label() != other->mInputs[i]->label())
+            return false;
+    }
+    for (int i = 0; i < mOutputs.size(); i++) {
+        if (mOutputs[i]->name() != other->mOutputs[i]->name()
+                || mOutputs[i]->label() != other->mOutputs[i]->label())
+            return false;
+    }
+    return true;
+}
+
 /////
 
 
@@ -20,7 +20,9 @@
 
 #include "editor_global.h"
 #include "scriptvariable.h"
+#include "symboltable.h"
 
+#include <QHash>
 #include <QList>
 #include <QMap>
 #include <QPolygonF>
@@ -36,15 +38,15 @@ class NodeInput
 public:
     NodeInput(const QString &name) :
         mNode(0),
-        mName(name),
-        mLabel(name)
+        mName(symbol(name)),
+        mLabel(mName)
     {
     }
 
     NodeInput(const QString &name, const QString &label) :
         mNode(0),
-        mName(name),
-        mLabel(label)
+        mName(symbol(name)),
+        mLabel(symbol(label))
     {
     }
 
@@ -62,10 +64,10 @@ public:
     {
     }
 
-    void setName(const QString &name) { mName = name; }
+    void setName(const QString &name) { mName = symbol(name); }
     const QString &name() const { return mName; }
 
-    void setLabel(const QString &label) { mLabel = label; }
+    void setLabel(const QString &label) { mLabel = symbol(label); }
     const QString &label() const { return mLabel; }
 
     bool isKnown() const;
@@ -93,15 +95,15 @@ class NodeOutput
 public:
     NodeOutput(const QString &name) :
         mNode(0),
-        mName(name),
-        mLabel(name)
+        mName(symbol(name)),
+        mLabel(mName)
     {
     }
 
     NodeOutput(const QString &name, const QString &label) :
         mNode(0),
-        mName(name),
-        mLabel(label)
+        mName(symbol(name)),
+        mLabel(symbol(label))
     {
     }
 
@@ -119,10 +121,10 @@ public:
     {
     }
 
-    void setName(const QString &name) { mName = name; }
+    void setName(const QString &name) { mName = symbol(name); }
     const QString &name() const { return mName; }
 
-    void setLabel(const QString &label) { mLabel = label; }
+    void setLabel(const QString &label) { mLabel = symbol(label); }
     const QString &label() const { return mLabel; }
 
     bool isKnown() const;
@@ -163,13 +165,14 @@ public:
     BaseNode(int id, const QString &name) :
         mID(id),
         mIsProjectRootNode(false),
-        mLabel(name)
+        mLabel(name),
+        mParentNode(0)
     {
     }
 
     virtual ~BaseNode();
 
-    void setID(int id) { mID = id; }
+    void setID(int id);
     int id()const { return mID; }
 
     void setLabel(const QString &label) { mLabel = label; }
@@ -191,10 +194,7 @@ public:
     }
     NodeInput *input(const QString &name)
     {
-        foreach (NodeInput *input, mInputs)
-            if (input->name() == name)
-                return input;
-        return 0;
+        return mInputByName.value(name);
     }
     int indexOf(NodeInput *input)
     {
@@ -213,10 +213,7 @@ public:
     }
     NodeOutput *output(const QString &name)
     {
-        foreach (NodeOutput *output, mOutputs)
-            if (output->name() == name)
-                return output;
-        return 0;
+        return mOutputByName.value(name);
     }
     int indexOf(NodeOutput *output)
     {
@@ -248,7 +245,10 @@ public:
     {
         return mVariables;
     }
-    ScriptVariable *variable(const QString &label);
+    ScriptVariable *variable(const QString &name)
+    {
+        return mVariableByName.value(name);
+    }
     int variableCount() const
     {
         return mVariables.size();
@@ -260,6 +260,12 @@ public:
     void insertVariable(int index, ScriptVariable *var);
     ScriptVariable *removeVariable(ScriptVariable *var);
 
+    // The name lookups above use an index.  Call these after changing the
+    // name of an input, output or variable belonging to this node.
+    void inputNameChanged(NodeInput *input, const QString &oldName);
+    void outputNameChanged(NodeOutput *output, const QString &oldName);
+    void variableNameChanged(ScriptVariable *var, const QString &oldName);
+
     virtual bool isKnown(const ScriptVariable *var) = 0;
     virtual bool isKnown(const NodeInput *input) = 0;
     virtual bool isKnown(const NodeOutput *output) = 0;
@@ -277,6 +283,10 @@ public:
 
     bool syncWithInfo(BaseNode *infoNode);
 
+    // True if the variables, inputs and outputs match the other node's in
+    // everything syncWithInfo() looks at.
+    bool sameSignature(BaseNode *other);
+
     void setProjectRootNode() {  mIsProjectRootNode = true; }
     bool isProjectRootNode() { return mIsProjectRootNode; }
 
@@ -290,6 +300,17 @@ protected:
     QList<NodeConnection*> mConnections;
     QPointF mPosition;
 //    QString mComment;
+    ScriptNode *mParentNode; // the ScriptNode this node was inserted into
+
+private:
+    void rebuildNameIndex();
+
+    // Name -> the first input/output/variable with that name.
+    QHash<QString,NodeInput*> mInputByName;
+    QHash<QString,NodeOutput*> mOutputByName;
+    QHash<QString,ScriptVariable*> mVariableByName;
+
+    friend class ScriptNode;
 };
 
 class MetaEventNode : public BaseNode
@@ -380,18 +401,20 @@ public:
     {
         Q_ASSERT(nodeByID(node->id()) == 0);
         mNodes.insert(index, node);
+        mNodeByID[node->id()] = node;
+        node->mParentNode = this;
     }
     BaseNode *removeNode(int index)
     {
-        return mNodes.takeAt(index);
+        BaseNode *node = mNodes.takeAt(index);
+        mNodeByID.remove(node->id());
+        node->mParentNode = 0;
+        return node;
     }
     BaseNode *nodeByID(int id)
     {
         if (id == mID) return this;
-        foreach (BaseNode *node, mNodes)
-            if (node->id() == id)
-                return node;
-        return NULL;
+        return mNodeByID.value(id);
     }
     int indexOf(BaseNode *node)
     {
@@ -428,6 +451,9 @@ private:
     QString mSource; // path to .pzs
     ScriptInfo *mInfo;
     QList<BaseNode*> mNodes;
+    QHash<int,BaseNode*> mNodeByID; // kept in sync with mNodes and BaseNode::setID()
+
+    friend class BaseNode;
 };
 
 #endif // NODE_H
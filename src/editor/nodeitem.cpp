@@ -53,6 +53,9 @@ NodeItem::NodeItem(ProjectScene *scene, BaseNode *node, QGraphicsItem *parent) :
     setFlag(ItemIsMovable, true);
     setFlag(ItemSendsScenePositionChanges, true);
     setAcceptHoverEvents(true);
+    // Anything that changes the appearance must call update() to refresh the
+    // cached pixmap.  Hovering does so by default.
+    setCacheMode(DeviceCoordinateCache);
 #if 0
     QGraphicsDropShadowEffect *effect = new QGraphicsDropShadowEffect;
     effect->setBlurRadius(4);
@@ -104,11 +107,18 @@ void NodeItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
     painter->setPen(pen);
 
     QColor bg = mBgColor;
-    QRect textRect = painter->fontMetrics().boundingRect(mNode->label());
-    QRectF nameRect = QRectF(mBounds.x(), mBounds.y(), textRect.width() + 6, textRect.height() + 6);
+    qreal lod = ScriptScene::levelOfDetail(painter, option);
+    if (lod < LOD_SIMPLE) {
+        painter->fillRect(mBounds, bg);
+        painter->drawRect(mBounds);
+        return;
+    }
+
+    QRectF nameRect = this->nameRect();
     painter->fillRect(nameRect, bg);
     painter->drawRect(nameRect);
-    painter->drawText(nameRect, Qt::AlignCenter, mNode->label());
+    if (mScene->isTextLegible(lod))
+        painter->drawText(nameRect, Qt::AlignCenter, mNode->label());
 
     QRectF bodyRect = mBounds.adjusted(0, nameRect.height(), 0, 0);
     painter->fillRect(bodyRect, bg);
@@ -265,6 +275,16 @@ bool NodeItem::displaysVariable(ScriptVariable *var)
     return mVariablesItem->displaysVariable(var);
 }
 
+// Repaint the cached variable items that refer to a variable of another node.
+void NodeItem::variableRefsChanged(int nodeID)
+{
+    foreach (BaseVariableItem *item, mVariablesItem->mItems) {
+        if (item->mVariable->variableRef().length() &&
+                item->mVariable->variableRefID() == nodeID)
+            item->update();
+    }
+}
+
 void NodeItem::updateLayout()
 {
     prepareGeometryChange();
@@ -276,7 +296,8 @@ void NodeItem::updateLayout()
     int inputsHeight = mInputsItem->childrenBoundingRect().height();
     int outputsHeight = mOutputsItem->childrenBoundingRect().height();
     QSize variablesSize = mVariablesItem->childrenBoundingRect().size().toSize();
-    QSize nameSize = QFontMetrics(mScene->font()).boundingRect(mNode->label()).size() + QSize(6, 6);
+    QSize nameSize = mScene->textBounds(mNode->label()).size() + QSize(6, 6);
+    mNameSize = nameSize;
     int buttonsWidth = 2 + qMax(nameSize.height(), 16) * 2 + 1;
     int variablesPadding = 8;
 
@@ -294,6 +315,8 @@ void NodeItem::updateLayout()
         mScene->moved(item);
     foreach (NodeOutputItem *item, mOutputsItem->mItems)
         mScene->moved(item);
+
+    update();
 }
 
 void NodeItem::syncWithNode()
@@ -307,8 +330,7 @@ void NodeItem::syncWithNode()
 
 QRectF NodeItem::nameRect()
 {
-    QRect textRect = QFontMetrics(mScene->font()).boundingRect(mNode->label());
-    return QRectF(mBounds.x(), mBounds.y(), textRect.width() + 6, textRect.height() + 6);
+    return QRectF(mBounds.topLeft(), mNameSize);
 }
 
 QRectF NodeItem::deleteRect()
@@ -333,6 +355,7 @@ NodeInputItem::NodeInputItem(ScriptScene *scene, NodeInput *pin, QGraphicsItem *
     mConnectHighlight(false)
 {
     setAcceptHoverEvents(true);
+    setCacheMode(DeviceCoordinateCache);
     updateLayout();
 }
 
@@ -344,11 +367,6 @@ QRectF NodeInputItem::boundingRect() const
 void NodeInputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
 {
     QRectF r = boundingRect().adjusted(3, 3, -3, -3); // remove pen-width
-    QPainterPath path;
-    path.moveTo(r.topRight());
-    path.lineTo(r.x() + size().width() * 0.65, r.top());
-    path.arcTo(r.x(), r.y(), size().width() * 0.65, r.height(), 90, 180);
-    path.lineTo(r.bottomRight());
     painter->setPen(Qt::NoPen);
 //    QColor color = QColor(30, 40, 40);
     QColor color = Qt::gray;
@@ -357,6 +375,14 @@ void NodeInputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *opt
     if (option->state & QStyle::State_MouseOver)
         if (!ConnectionsItem::mMakingConnection)
             color = color.lighter(125);
+
+    qreal lod = ScriptScene::levelOfDetail(painter, option);
+    if (lod < LOD_SIMPLE) {
+        painter->fillRect(r, color);
+        return;
+    }
+
+    const QPainterPath &path = mPath;
     painter->fillPath(path, color);
 
     painter->setRenderHint(QPainter::Antialiasing, true);
@@ -369,7 +395,8 @@ void NodeInputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *opt
     QPen pen(color, 2);
     painter->setPen(pen);
     painter->drawPath(path);
-    painter->drawText(r.adjusted(size().width() / 4, 0, 0, 0), Qt::AlignCenter, mInput->label());
+    if (mScene->isTextLegible(lod))
+        painter->drawText(r.adjusted(size().width() / 4, 0, 0, 0), Qt::AlignCenter, mInput->label());
 }
 
 void NodeInputItem::mousePressEvent(QGraphicsSceneMouseEvent *event)
@@ -395,14 +422,21 @@ void NodeInputItem::mousePressEvent(QGraphicsSceneMouseEvent *event)
 
 void NodeInputItem::updateLayout()
 {
-    QFontMetricsF fm(mScene->font());
-    qreal labelWidth = fm.boundingRect(mInput->label()).width();
+    qreal labelWidth = mScene->textBoundsF(mInput->label()).width();
     QRectF r(-(size().width() + labelWidth), -size().height() / 2, size().width() + labelWidth, size().height());
     QRectF bounds = r.adjusted(-3, -3, 3, 3); // adjust for pen width
     if (bounds != mBounds) {
         prepareGeometryChange();
         mBounds = bounds;
     }
+
+    mPath = QPainterPath();
+    mPath.moveTo(r.topRight());
+    mPath.lineTo(r.x() + size().width() * 0.65, r.top());
+    mPath.arcTo(r.x(), r.y(), size().width() * 0.65, r.height(), 90, 180);
+    mPath.lineTo(r.bottomRight());
+
+    update(); // the label or its color may have changed
 }
 
 /////
@@ -414,6 +448,7 @@ NodeOutputItem::NodeOutputItem(ScriptScene *scene, NodeOutput *pin, QGraphicsIte
     mConnectHighlight(false)
 {
     setAcceptHoverEvents(true);
+    setCacheMode(DeviceCoordinateCache);
     updateLayout();
 }
 
@@ -425,11 +460,6 @@ QRectF NodeOutputItem::boundingRect() const
 void NodeOutputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
 {
     QRectF r = boundingRect().adjusted(3, 3, -3, -3); // remove pen-width
-    QPainterPath path;
-    path.moveTo(r.topLeft());
-    path.lineTo(r.right() - size().width() * 0.65, r.top());
-    path.arcTo(r.right() - size().width() * 0.65, r.y(), size().width() * 0.65, r.height(), 90, -180);
-    path.lineTo(r.bottomLeft());
     painter->setPen(Qt::NoPen);
 //    QColor color = QColor(30, 40, 40);
     QColor color = Qt::gray;
@@ -438,6 +468,14 @@ void NodeOutputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *op
     if (option->state & QStyle::State_MouseOver)
         if (!ConnectionsItem::mMakingConnection)
             color = color.lighter(125);
+
+    qreal lod = ScriptScene::levelOfDetail(painter, option);
+    if (lod < LOD_SIMPLE) {
+        painter->fillRect(r, color);
+        return;
+    }
+
+    const QPainterPath &path = mPath;
     painter->fillPath(path, color);
 
     painter->setRenderHint(QPainter::Antialiasing, true);
@@ -450,7 +488,7 @@ void NodeOutputItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *op
     painter->setPen(pen);
     painter->drawPath(path);
 
-    if (mOutput->node()->isEventNode())
+    if (mOutput->node()->isEventNode() || !mScene->isTextLegible(lod))
         return;
 
     painter->drawText(r, Qt::AlignCenter, mOutput->label());
@@ -482,17 +520,24 @@ void NodeOutputItem::mousePressEvent(QGraphicsSceneMouseEvent *event)
 
 void NodeOutputItem::updateLayout()
 {
-    QFontMetricsF fm(mScene->font());
     QString label = mOutput->label();
     if (mOutput->node()->isEventNode())
         label.clear();
-    qreal labelWidth = fm.boundingRect(label).width();
+    qreal labelWidth = mScene->textBoundsF(label).width();
     QRectF r(0, -size().height() / 2, size().width() + labelWidth, size().height());
     QRectF bounds = r.adjusted(-3, -3, 3, 3); // adjust for pen width
     if (bounds != mBounds) {
         prepareGeometryChange();
         mBounds = bounds;
     }
+
+    mPath = QPainterPath();
+    mPath.moveTo(r.topLeft());
+    mPath.lineTo(r.right() - size().width() * 0.65, r.top());
+    mPath.arcTo(r.right() - size().width() * 0.65, r.y(), size().width() * 0.65, r.height(), 90, -180);
+    mPath.lineTo(r.bottomLeft());
+
+    update(); // the label or its color may have changed
 }
 
 /////
@@ -664,6 +709,7 @@ BaseVariableItem::BaseVariableItem(ScriptScene *scene, ScriptVariable *var, QGra
 {
     setAcceptDrops(true);
     setAcceptHoverEvents(true);
+    setCacheMode(DeviceCoordinateCache);
 
     mGroupLabelWidth = mGroupValueWidth = 32;
 }
@@ -687,6 +733,9 @@ void BaseVariableItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *
     painter->setPen(color);
     painter->drawRect(valueRect.adjusted(0,0,-1,-1));
 
+    if (!mScene->isTextLegible(ScriptScene::levelOfDetail(painter, option)))
+        return;
+
     if (mVariable->node()->isEventNode()) {
         painter->drawText(valueRect.adjusted(3,0,-3,0), Qt::AlignVCenter, mVariable->label());
         return;
@@ -845,6 +894,7 @@ void BaseVariableItem::dropEvent(QGraphicsSceneDragDropEvent *event)
     ProjectDocument *doc = mScene->document();
 
     mDropHighlight = false;
+    update();
 
     if (event->mimeData()->hasFormat(VARIABLE_MIME_TYPE)) {
         QStringList varNames = getDropData(event);
@@ -887,24 +937,23 @@ void BaseVariableItem::updateLayout(int groupLabelWidth, int groupValueWidth)
         mGroupLabelWidth = groupLabelWidth;
         mGroupValueWidth = groupValueWidth;
     }
+    update(); // the value may have changed
 }
 
 QSize BaseVariableItem::labelSizeHint()
 {
     if (mVariable->node()->isEventNode())
         return QSize(0, 0);
-    QFontMetrics fm(mScene->font());
-    return fm.boundingRect(mVariable->label()).size() + QSize(4, 3 + 3);
+    return mScene->textBounds(mVariable->label()).size() + QSize(4, 3 + 3);
 }
 
 QSize BaseVariableItem::valueSizeHint()
 {
-    QFontMetrics fm(mScene->font());
     QString value = valueString();
     bool xbox = true;
     if (mVariable->node()->isEventNode())
         xbox = false;
-    return fm.boundingRect(value).size() + QSize(3 + 3 + (xbox ? 16 + 2 : 0), 3 + 3);
+    return mScene->textBounds(value).size() + QSize(3 + 3 + (xbox ? 16 + 2 : 0), 3 + 3);
 }
 
 QRectF BaseVariableItem::valueRect(const QRectF &itemRect)
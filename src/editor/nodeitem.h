@@ -20,6 +20,7 @@
 
 #include "editor_global.h"
 #include <QGraphicsItem>
+#include <QPainterPath>
 
 class NodeInputItem : public QGraphicsItem
 {
@@ -38,6 +39,7 @@ public:
     ScriptScene *mScene;
     NodeInput *mInput;
     QRectF mBounds;
+    QPainterPath mPath; // the outline, set by updateLayout()
     bool mConnectHighlight;
 };
 
@@ -58,6 +60,7 @@ public:
     ScriptScene *mScene;
     NodeOutput *mOutput;
     QRectF mBounds;
+    QPainterPath mPath; // the outline, set by updateLayout()
     bool mConnectHighlight;
 };
 
@@ -214,6 +217,7 @@ public:
     void outputsChanged();
     void variablesChanged();
     bool displaysVariable(ScriptVariable *var);
+    void variableRefsChanged(int nodeID);
     void updateLayout();
     void syncWithNode();
 
@@ -223,6 +227,7 @@ public:
 
     ProjectScene *mScene;
     QRectF mBounds;
+    QSize mNameSize; // set by updateLayout()
     BaseNode *mNode;
     VariableGroupItem *mVariablesItem;
     NodeInputGroupItem *mInputsItem;
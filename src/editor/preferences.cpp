@@ -32,6 +32,8 @@ static const QLatin1String KEY_BG_COLOR("BackgroundColor");
 static const QLatin1String KEY_SHOW_TILE_GRID("ShowTileGrid");
 static const QLatin1String KEY_TILE_GRID_COLOR("TileGridColor");
 static const QLatin1String KEY_RECENT_FILES("RecentFiles");
+static const QLatin1String KEY_LOADER_THREADS("LoaderThreads");
+static const QLatin1String KEY_BATCHED_CONNECTIONS("BatchedConnectionsThreshold");
 
 Preferences::Preferences() :
     QObject(),
@@ -39,6 +41,8 @@ Preferences::Preferences() :
 {
     mScriptsDirectory = mSettings->value(KEY_SCRIPTS_DIRECTORY, QString()).toString();
     mGameDirectories = mSettings->value(KEY_GAME_DIRECTORIES, QStringList()).toStringList();
+    mLoaderThreadCount = mSettings->value(KEY_LOADER_THREADS, 0).toInt();
+    mBatchedConnectionsThreshold = mSettings->value(KEY_BATCHED_CONNECTIONS, 2000).toInt();
     mUseOpenGL = mSettings->value(KEY_USE_OPENGL, false).toBool();
     mShowMiniMap = mSettings->value(KEY_SHOW_MINIMAP, true).toBool();
     mMiniMapWidth = mSettings->value(KEY_MINIMAP_WIDTH, 256).toInt();
@@ -122,6 +126,24 @@ void Preferences::setGameDirectories(const QStringList &dirList)
     emit gameDirectoriesChanged();
 }
 
+void Preferences::setLoaderThreadCount(int count)
+{
+    count = qMax(count, 0);
+    if (count == mLoaderThreadCount)
+        return;
+    mLoaderThreadCount = count;
+    mSettings->setValue(KEY_LOADER_THREADS, mLoaderThreadCount);
+}
+
+void Preferences::setBatchedConnectionsThreshold(int count)
+{
+    count = qMax(count, 0);
+    if (count == mBatchedConnectionsThreshold)
+        return;
+    mBatchedConnectionsThreshold = count;
+    mSettings->setValue(KEY_BATCHED_CONNECTIONS, mBatchedConnectionsThreshold);
+}
+
 void Preferences::setUseOpenGL(bool useOpenGL)
 {
     if (mUseOpenGL == useOpenGL)
@@ -47,6 +47,17 @@ public:
     QStringList gameDirectories() const
     { return mGameDirectories; }
 
+    // Zero means use QThread::idealThreadCount().
+    void setLoaderThreadCount(int count);
+    int loaderThreadCount() const
+    { return mLoaderThreadCount; }
+
+    // Scripts with at least this many connections draw them in one batch
+    // rather than as separate scene items.  Zero means never.
+    void setBatchedConnectionsThreshold(int count);
+    int batchedConnectionsThreshold() const
+    { return mBatchedConnectionsThreshold; }
+
     bool useOpenGL() const
     { return mUseOpenGL; }
     
@@ -109,6 +120,8 @@ private:
     QString mConfigDirectory;
     QString mTilesDirectory;
     QStringList mGameDirectories;
+    int mLoaderThreadCount;
+    int mBatchedConnectionsThreshold;
 };
 
 inline Preferences *prefs() { return Preferences::instance(); }
@@ -21,6 +21,9 @@ PreferencesDialog::PreferencesDialog(QWidget *parent) :
     foreach (QString f, prefs()->gameDirectories())
         ui->gameDirList->addItem(QDir::toNativeSeparators(f));
 
+    ui->loaderThreads->setValue(prefs()->loaderThreadCount());
+    ui->showMiniMap->setChecked(prefs()->showMiniMap());
+
     syncUI();
 }
 
@@ -56,6 +59,8 @@ void PreferencesDialog::accept()
         QListWidgetItem *item = ui->gameDirList->item(row);
         dirList += item->text();
     }
+    prefs()->setLoaderThreadCount(ui->loaderThreads->value());
+    prefs()->setShowMiniMap(ui->showMiniMap->isChecked());
     prefs()->setGameDirectories(dirList);
 
     QDialog::accept();
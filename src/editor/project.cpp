@@ -18,7 +18,9 @@
 #include "project.h"
 
 #include "luamanager.h"
+#include "metaeventmanager.h"
 #include "node.h"
+#include "scriptmanager.h"
 #include "scriptvariable.h"
 
 Project::Project() :
@@ -54,6 +56,31 @@ Project::~Project()
     delete mRootNode;
 }
 
+void Project::resolveInfo()
+{
+    foreach (BaseNode *node, mRootNode->nodes()) {
+        if (LuaNode *lnode = node->asLuaNode()) {
+            if (LuaInfo *info = luamgr()->luaInfo(lnode->source())) {
+                lnode->setInfo(info);
+                lnode->syncWithInfo();
+            }
+        }
+        if (MetaEventNode *enode = node->asEventNode()) {
+            Q_ASSERT(enode->outputCount() == 1);
+            if (MetaEventInfo *info = eventmgr()->info(enode->source(), enode->eventName())) {
+                enode->setInfo(info);
+                enode->syncWithInfo();
+            }
+        }
+        if (ScriptNode *snode = node->asScriptNode()) {
+            if (ScriptInfo *info = scriptmgr()->scriptInfo(snode->source())) {
+                snode->setInfo(info);
+                snode->syncWithInfo();
+            }
+        }
+    }
+}
+
 ScriptVariable *Project::resolveVariable(const QString &name)
 {
     QStringList sl = name.split(QLatin1Char(':'));
@@ -33,6 +33,10 @@ public:
         return mRootNode;
     }
 
+    // Looks up the Lua, event and script file each node comes from and syncs
+    // the node with it.
+    void resolveInfo();
+
     ScriptVariable *resolveVariable(const QString &name);
 
     bool isValidInputName(const QString &name, int index);
@@ -30,7 +30,7 @@
 #include "project.h"
 #include "projectchanger.h"
 #include "projectdocument.h"
-#include "projectreader.h"
+#include "projectloader.h"
 #include "scenescriptdialog.h"
 #include "variablepropertiesdialog.h"
 
@@ -49,8 +49,14 @@ SINGLETON_IMPL(ProjectActions)
 
 ProjectActions::ProjectActions(Ui::MainWindow *actions, QObject *parent) :
     QObject(parent),
-    mActions(actions)
+    mActions(actions),
+    mLoader(new ProjectLoader(MainWindow::instance(), this))
 {
+    qRegisterMetaType<Project*>("Project*");
+    connect(mLoader, SIGNAL(loaded(QString,Project*,QString)),
+            SLOT(projectLoaded(QString,Project*,QString)));
+    connect(mLoader, SIGNAL(finished()), SLOT(applyCurrentDocumentLater()));
+
     mUndoAction = mainwin()->undoGroup()->createUndoAction(this, tr("Undo"));
     mRedoAction = mainwin()->undoGroup()->createRedoAction(this, tr("Redo"));
     mUndoAction->setShortcuts(QKeySequence::Undo);
@@ -125,7 +131,7 @@ void ProjectActions::openProject()
     QString filter = tr("All Files (*)");
     filter += QLatin1String(";;");
 
-    QString selectedFilter = tr("PZDraft project (*.pzs)");
+    QString selectedFilter = tr("PZDraft project (*.pzs *.pzsb)");
     filter += selectedFilter;
 
     QStringList fileNames =
@@ -197,16 +203,49 @@ bool ProjectActions::openProject(const QString &fileName)
         return true;
     }
 
-    QFileInfo fileInfo(fileName);
-#if 0
-    PROGRESS progress(tr("Reading %1").arg(fileInfo.fileName()));
-#endif
-    ProjectReader reader;
-    Project *project = reader.read(fileName);
+    // The script is read on a worker thread, projectLoaded() adds the
+    // document.
+    mLoader->load(fileName);
+    return true;
+}
+
+void ProjectActions::setCurrentDocumentLater(const QString &fileName)
+{
+    mCurrentDocumentLater = fileName;
+    applyCurrentDocumentLater();
+}
+
+void ProjectActions::applyCurrentDocumentLater()
+{
+    if (mCurrentDocumentLater.isEmpty())
+        return;
+    int n = docman()->findDocument(mCurrentDocumentLater);
+    if (n != -1 && docman()->documentAt(n) != docman()->currentDocument())
+        docman()->setCurrentDocument(n);
+    if (!mLoader->isBusy())
+        mCurrentDocumentLater.clear();
+}
+
+void ProjectActions::projectLoaded(const QString &fileName, Project *project,
+                                   const QString &error)
+{
+    addLoadedProject(fileName, project, error);
+    applyCurrentDocumentLater();
+}
+
+void ProjectActions::addLoadedProject(const QString &fileName, Project *project,
+                                      const QString &error)
+{
     if (!project) {
         QMessageBox::critical(MainWindow::instance(), tr("Error Reading Project"),
-                              reader.errorString());
-        return false;
+                              error);
+        return;
+    }
+
+    // It may have been opened some other way while it was being read.
+    if (docman()->findDocument(fileName) != -1) {
+        delete project;
+        return;
     }
 
 #if 0
@@ -224,18 +263,16 @@ bool ProjectActions::openProject(const QString &fileName)
 
     docman()->addDocument(new ProjectDocument(project, fileName));
     if (docman()->failedToAdd())
-        return false;
+        return;
 
     prefs()->addRecentFile(fileName);
-
-    return true;
 }
 
 bool ProjectActions::openFile(const QString &fileName)
 {
     if (fileName.endsWith(QLatin1String(".lua")))
         return openLuaFile(fileName);
-    if (fileName.endsWith(QLatin1String(".pzs")))
+    if (fileName.endsWith(QLatin1String(".pzs")) || fileName.endsWith(QLatin1String(".pzsb")))
         return openProject(fileName);
     return false;
 }
@@ -290,6 +327,12 @@ bool ProjectActions::saveFileAs()
 
     QString selectedFilter = document()->filter();
     filter += selectedFilter;
+    if (document()->isProjectDocument()) {
+        filter += QLatin1String(";;");
+        filter += tr("ScriptEd binary files (*.pzsb)");
+        if (document()->fileName().endsWith(QLatin1String(".pzsb")))
+            selectedFilter = tr("ScriptEd binary files (*.pzsb)");
+    }
 
     const QString fileName =
             QFileDialog::getSaveFileName(MainWindow::instance(), QString(), suggestedFileName,
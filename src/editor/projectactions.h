@@ -24,6 +24,8 @@
 
 #include <QObject>
 
+class ProjectLoader;
+
 class ProjectActions : public QObject, public Singleton<ProjectActions>
 {
     Q_OBJECT
@@ -39,6 +41,10 @@ public:
     QAction *undoAction() { return mUndoAction; }
     QAction *redoAction() { return mRedoAction; }
 
+    // Makes a document current once it is open.  Scripts are read in the
+    // background, so this keeps applying until every pending one is added.
+    void setCurrentDocumentLater(const QString &fileName);
+
 public slots:
     void newProject();
     void newLuaFile();
@@ -88,10 +94,18 @@ public slots:
 
     void updateActions();
 
+private slots:
+    void projectLoaded(const QString &fileName, Project *project, const QString &error);
+    void applyCurrentDocumentLater();
+
 private:
+    void addLoadedProject(const QString &fileName, Project *project, const QString &error);
+
     Ui::MainWindow *mActions;
     QAction *mUndoAction;
     QAction *mRedoAction;
+    ProjectLoader *mLoader;
+    QString mCurrentDocumentLater;
 };
 
 #endif // PROJECTACTIONS_H
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROJECTBINARY_H
+#define PROJECTBINARY_H
+
+/*
+ * The binary script format (.pzsb).  It holds exactly what the .pzs XML
+ * format holds, in the same order, so a file can be converted either way
+ * without changing it.  All numbers are little-endian.
+ *
+ * Header (24 bytes):
+ *   char[4] magic "PZSB"
+ *   u32 version
+ *   u32 number of strings
+ *   u32 offset of the string table
+ *   u32 offset of the body
+ *   u32 size of the body
+ *
+ * String table:
+ *   u32[count + 1] offsets of each string relative to the end of this array,
+ *                  the last one is the size of the string data
+ *   UTF-8 string data, no terminators
+ *
+ * Strings are referenced by index (u32), PZSB_NO_STRING for none.  Doubles
+ * are stored rounded to the 3 decimals the XML format keeps.
+ *
+ * Body:
+ *   u32 script version (the XML "version" attribute)
+ *   the root node's variables, inputs, outputs and connections (see below)
+ *   u32 count, then for each child node:
+ *     u8 kind (PZSB_EVENT_NODE etc)
+ *     i32 id
+ *     string label
+ *     string event name (event nodes only)
+ *     f64 x, f64 y
+ *     string source file, relative to the script file
+ *     variables
+ *     inputs, outputs (not for event nodes)
+ *     connections
+ *
+ *   variables: u32 count, then for each: string type, string name,
+ *              string label (root node only), u8 PZSB_VALUE then string
+ *              value or u8 PZSB_REFERENCE then i32 node ID, string variable
+ *   inputs/outputs: u32 count, then for each: string name, string label
+ *                   (root node only)
+ *   connections: u32 count, then for each: string output, i32 receiver ID,
+ *                string input, u32 point count, f64 x/y pairs
+ */
+
+#define PZSB_MAGIC "PZSB"
+#define PZSB_VERSION 1
+#define PZSB_HEADER_SIZE 24
+#define PZSB_NO_STRING 0xFFFFFFFF
+
+#define PZSB_EVENT_NODE 1
+#define PZSB_LUA_NODE 2
+#define PZSB_SCRIPT_NODE 3
+
+#define PZSB_VALUE 0
+#define PZSB_REFERENCE 1
+
+#endif // PROJECTBINARY_H
@@ -297,16 +297,24 @@ public:
 
     void redo()
     {
-        mInput->initFrom(&mNewValue);
+        change(&mNewValue);
         mChanger->afterChangeInput(mInput, &mOldValue);
     }
 
     void undo()
     {
-        mInput->initFrom(&mOldValue);
+        change(&mOldValue);
         mChanger->afterChangeInput(mInput, &mNewValue);
     }
 
+    void change(const NodeInput *value)
+    {
+        QString oldName = mInput->name();
+        mInput->initFrom(value);
+        if (mInput->node() && mInput->name() != oldName)
+            mInput->node()->inputNameChanged(mInput, oldName);
+    }
+
     bool merge(ProjectChange *other)
     {
         ChangeInput *o = (ChangeInput*) other;
@@ -448,16 +456,24 @@ public:
 
     void redo()
     {
-        mOutput->initFrom(&mNewValue);
+        change(&mNewValue);
         mChanger->afterChangeOutput(mOutput, &mOldValue);
     }
 
     void undo()
     {
-        mOutput->initFrom(&mOldValue);
+        change(&mOldValue);
         mChanger->afterChangeOutput(mOutput, &mNewValue);
     }
 
+    void change(const NodeOutput *value)
+    {
+        QString oldName = mOutput->name();
+        mOutput->initFrom(value);
+        if (mOutput->node() && mOutput->name() != oldName)
+            mOutput->node()->outputNameChanged(mOutput, oldName);
+    }
+
     bool merge(ProjectChange *other)
     {
         ChangeOutput *o = (ChangeOutput*) other;
@@ -671,16 +687,24 @@ public:
 
     void redo()
     {
-        *mVariable = ScriptVariable(&mNewValue);
+        change(&mNewValue);
         mChanger->afterChangeVariable(mVariable, &mOldValue);
     }
 
     void undo()
     {
-        *mVariable = ScriptVariable(&mOldValue);
+        change(&mOldValue);
         mChanger->afterChangeVariable(mVariable, &mNewValue);
     }
 
+    void change(const ScriptVariable *value)
+    {
+        QString oldName = mVariable->name();
+        *mVariable = ScriptVariable(value);
+        if (mVariable->node() && mVariable->name() != oldName)
+            mVariable->node()->variableNameChanged(mVariable, oldName);
+    }
+
     QString text() const
     {
         return mChanger->tr("Change Variable");
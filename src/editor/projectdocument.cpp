@@ -17,13 +17,10 @@
 
 #include "projectdocument.h"
 
-#include "luamanager.h"
-#include "metaeventmanager.h"
 #include "node.h"
 #include "project.h"
 #include "projectchanger.h"
 #include "projectwriter.h"
-#include "scriptmanager.h"
 
 #include <QFileInfo>
 #include <QUndoStack>
@@ -37,27 +34,7 @@ ProjectDocument::ProjectDocument(Project *prj, const QString &fileName) :
     mUndoStack = new QUndoStack(this);
     connect(mUndoStack, SIGNAL(cleanChanged(bool)), SIGNAL(cleanChanged()));
 
-    foreach (BaseNode *node, mProject->rootNode()->nodes()) {
-        if (LuaNode *lnode = node->asLuaNode()) {
-            if (LuaInfo *info = luamgr()->luaInfo(lnode->source())) {
-                lnode->setInfo(info);
-                lnode->syncWithInfo();
-            }
-        }
-        if (MetaEventNode *enode = node->asEventNode()) {
-            Q_ASSERT(enode->outputCount() == 1);
-            if (MetaEventInfo *info = eventmgr()->info(enode->source(), enode->eventName())) {
-                enode->setInfo(info);
-                enode->syncWithInfo();
-            }
-        }
-        if (ScriptNode *snode = node->asScriptNode()) {
-            if (ScriptInfo *info = scriptmgr()->scriptInfo(snode->source())) {
-                snode->setInfo(info);
-                snode->syncWithInfo();
-            }
-        }
-    }
+    mProject->resolveInfo();
 }
 
 void ProjectDocument::setFileName(const QString &fileName)
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "projectloader.h"
+
+#include "luamanager.h"
+#include "node.h"
+#include "project.h"
+#include "projectreader.h"
+#include "scriptmanager.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QProgressDialog>
+#include <QRunnable>
+
+class ProjectLoaderJob : public QRunnable
+{
+public:
+    ProjectLoaderJob(ProjectLoader *loader, const QString &fileName, int generation,
+                     const QSet<QString> &knownLuaFiles,
+                     const QSet<QString> &knownScripts) :
+        mLoader(loader),
+        mFileName(fileName),
+        mGeneration(generation),
+        mKnownLuaFiles(knownLuaFiles),
+        mKnownScripts(knownScripts)
+    {
+    }
+
+    void run()
+    {
+        ProjectLoader::Result *result = new ProjectLoader::Result;
+        result->mFileName = mFileName;
+        result->mGeneration = mGeneration;
+        result->mProject = 0;
+        if (!mLoader->isCanceled(mGeneration)) {
+            ProjectReader reader;
+            result->mProject = reader.read(mFileName);
+            if (!result->mProject)
+                result->mError = reader.errorString();
+            else
+                readInfo(result);
+        }
+        mLoader->jobFinished(result);
+    }
+
+private:
+    // Reads what Project::resolveInfo() would otherwise read on the GUI
+    // thread.  The sources of nodes are absolute paths.
+    void readInfo(ProjectLoader::Result *result)
+    {
+        foreach (BaseNode *node, result->mProject->rootNode()->nodes()) {
+            if (mLoader->isCanceled(mGeneration))
+                return;
+            if (LuaNode *lnode = node->asLuaNode()) {
+                QString path = LuaManager::canonicalPath(lnode->source());
+                if (path.isEmpty() || mKnownLuaFiles.contains(path))
+                    continue;
+                mKnownLuaFiles.insert(path);
+                LuaCacheEntry entry;
+                if (LuaManager::readLuaFile(path, entry))
+                    result->mLuaEntries += entry;
+            }
+            if (ScriptNode *snode = node->asScriptNode()) {
+                QString path = ScriptManager::canonicalPath(snode->source());
+                if (path.isEmpty() || mKnownScripts.contains(path))
+                    continue;
+                mKnownScripts.insert(path);
+                if (ScriptNode *root = ScriptManager::loadScript(path))
+                    result->mScripts[path] = root;
+            }
+        }
+    }
+
+    ProjectLoader *mLoader;
+    QString mFileName;
+    int mGeneration;
+    QSet<QString> mKnownLuaFiles;
+    QSet<QString> mKnownScripts;
+};
+
+/////
+
+ProjectLoader::ProjectLoader(QWidget *dialogParent, QObject *parent) :
+    QObject(parent),
+    mDialogParent(dialogParent),
+    mDialog(0),
+    mGeneration(0),
+    mTotal(0)
+{
+}
+
+ProjectLoader::~ProjectLoader()
+{
+    cancel();
+    mPool.waitForDone();
+    foreach (Result *result, mResults)
+        deleteResult(result);
+}
+
+void ProjectLoader::load(const QString &fileName)
+{
+    if (isLoading(fileName))
+        return;
+
+    Pending pending;
+    pending.mFileName = fileName;
+    pending.mGeneration = generation();
+    mPending += pending;
+    ++mTotal;
+
+    if (!mDialog) {
+        mDialog = new QProgressDialog(mDialogParent);
+        mDialog->setWindowModality(Qt::NonModal);
+        mDialog->setMinimumDuration(500);
+        mDialog->setAutoReset(false);
+        mDialog->setAutoClose(false);
+        connect(mDialog, SIGNAL(canceled()), SLOT(cancel()));
+    }
+    if (mTotal == 1)
+        mDialog->reset();
+    mDialog->setLabelText(tr("Reading %1").arg(QFileInfo(fileName).fileName()));
+    mDialog->setMaximum(mTotal);
+    mDialog->setValue(mTotal - mPending.size());
+
+    // The pool deletes the job.
+    mPool.start(new ProjectLoaderJob(this, fileName, pending.mGeneration,
+                                     luamgr()->cachedPaths(),
+                                     scriptmgr()->loadedPaths()));
+}
+
+// A canceled file may still be pending, but it is loaded again if asked for.
+bool ProjectLoader::isLoading(const QString &fileName) const
+{
+    int current = generation();
+    foreach (const Pending &pending, mPending)
+        if (pending.mFileName == fileName && pending.mGeneration == current)
+            return true;
+    return false;
+}
+
+void ProjectLoader::deliverResults()
+{
+    QList<Result*> results;
+    int current;
+    {
+        QMutexLocker locker(&mMutex);
+        results = mResults;
+        mResults.clear();
+        current = mGeneration;
+    }
+
+    foreach (Result *result, results) {
+        for (int i = 0; i < mPending.size(); i++) {
+            if (mPending[i].mFileName == result->mFileName &&
+                    mPending[i].mGeneration == result->mGeneration) {
+                mPending.removeAt(i);
+                break;
+            }
+        }
+        if (result->mGeneration != current) {
+            deleteResult(result);
+            continue;
+        }
+        foreach (const LuaCacheEntry &entry, result->mLuaEntries)
+            luamgr()->insertCacheEntry(entry);
+        QMap<QString,ScriptNode*>::const_iterator it;
+        for (it = result->mScripts.constBegin(); it != result->mScripts.constEnd(); ++it)
+            scriptmgr()->insertScript(it.key(), it.value());
+        emit loaded(result->mFileName, result->mProject, result->mError);
+        delete result;
+    }
+
+    if (mPending.isEmpty()) {
+        mTotal = 0;
+        if (mDialog) {
+            mDialog->reset();
+            mDialog->hide();
+        }
+        emit finished();
+    } else if (mDialog) {
+        mDialog->setLabelText(tr("Reading %1").arg(QFileInfo(mPending.first().mFileName).fileName()));
+        mDialog->setValue(mTotal - mPending.size());
+    }
+}
+
+void ProjectLoader::cancel()
+{
+    QMutexLocker locker(&mMutex);
+    ++mGeneration;
+}
+
+bool ProjectLoader::isCanceled(int generation)
+{
+    QMutexLocker locker(&mMutex);
+    return generation != mGeneration;
+}
+
+int ProjectLoader::generation() const
+{
+    QMutexLocker locker(&mMutex);
+    return mGeneration;
+}
+
+void ProjectLoader::deleteResult(Result *result)
+{
+    delete result->mProject;
+    qDeleteAll(result->mScripts);
+    delete result;
+}
+
+// Called by the worker threads.
+void ProjectLoader::jobFinished(Result *result)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mResults += result;
+    }
+    QMetaObject::invokeMethod(this, "deliverResults", Qt::QueuedConnection);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROJECTLOADER_H
+#define PROJECTLOADER_H
+
+#include "editor_global.h"
+#include "luacache.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+
+class QProgressDialog;
+class QWidget;
+
+class ProjectLoaderJob;
+
+// Reads scripts on worker threads so opening them doesn't block the GUI.
+// The Lua and script files used by a script's nodes that LuaManager and
+// ScriptManager don't have yet are read on the worker too, and handed to the
+// managers before loaded() is emitted, so Project::resolveInfo() finds them
+// without parsing anything.
+// loaded() is emitted on the GUI thread for each file as it finishes.  While
+// files are being read a progress dialog with a Cancel button is shown;
+// canceling discards every script requested before it that hasn't been
+// delivered yet.  Scripts requested afterwards are loaded as usual.
+class ProjectLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ProjectLoader(QWidget *dialogParent, QObject *parent = 0);
+    ~ProjectLoader();
+
+    void load(const QString &fileName);
+    bool isLoading(const QString &fileName) const;
+    bool isBusy() const { return !mPending.isEmpty(); }
+
+signals:
+    // The receiver takes ownership of the project, which is NULL on error.
+    void loaded(const QString &fileName, Project *project, const QString &error);
+
+    // Emitted once nothing is left to read, including after a cancel.
+    void finished();
+
+private slots:
+    void deliverResults();
+    void cancel();
+
+private:
+    class Result
+    {
+    public:
+        QString mFileName;
+        int mGeneration;
+        Project *mProject;
+        QString mError;
+        QList<LuaCacheEntry> mLuaEntries;
+        QMap<QString,ScriptNode*> mScripts; // canonical path -> root node
+    };
+
+    // A load is canceled when cancel() was called after it was requested.
+    class Pending
+    {
+    public:
+        QString mFileName;
+        int mGeneration;
+    };
+
+    bool isCanceled(int generation);
+    int generation() const;
+    void jobFinished(Result *result);
+    static void deleteResult(Result *result);
+
+    QWidget *mDialogParent;
+    QProgressDialog *mDialog;
+    QThreadPool mPool;
+    mutable QMutex mMutex;
+    QList<Result*> mResults; // finished but not delivered, guarded by mMutex
+    int mGeneration; // incremented by cancel(), guarded by mMutex
+    QList<Pending> mPending; // requested but not delivered
+    int mTotal;
+
+    friend class ProjectLoaderJob;
+};
+
+#endif // PROJECTLOADER_H
@@ -20,14 +20,432 @@
 #include "luamanager.h"
 #include "node.h"
 #include "project.h"
+#include "projectbinary.h"
 #include "scriptvariable.h"
 
+#include <QBitArray>
 #include <QCoreApplication>
 #include <QDir>
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
+#include <QVector>
 #include <QXmlStreamReader>
+#include <QtEndian>
+
+#include <string.h>
+
+static QString resolveReference(const QString &fileName, const QString &relativeTo)
+{
+//    qDebug() << "resolveReference" << fileName << "relative to" << relativeTo;
+    if (fileName.isEmpty())
+        return fileName;
+    if (fileName == QLatin1String("."))
+        return relativeTo;
+    if (QDir::isRelativePath(fileName)) {
+        QString path = QDir(relativeTo).filePath(fileName);
+        QFileInfo info(path);
+        if (info.exists())
+            return info.canonicalFilePath();
+        return QDir::cleanPath(path);
+    }
+    return fileName;
+}
+
+// Reads the .pzsb format described in projectbinary.h.  The data is usually a
+// memory-mapped file; strings are only decoded the first time they are used,
+// and every use of the same string shares one QString.
+class BinaryProjectReader
+{
+    Q_DECLARE_TR_FUNCTIONS(BinaryProjectReader)
+
+public:
+    BinaryProjectReader() :
+        mData(0),
+        mPos(0),
+        mEnd(0),
+        mStringOffsets(0),
+        mStringData(0),
+        mStringDataSize(0)
+    {
+    }
+
+    Project *read(const uchar *data, qint64 size, const QString &path)
+    {
+        mError.clear();
+        mRelativeTo = QFileInfo(path).absolutePath();
+        mData = data;
+        mPos = 0;
+        mEnd = size;
+
+        if (size < PZSB_HEADER_SIZE || memcmp(data, PZSB_MAGIC, 4)) {
+            mError = tr("Not a script file.");
+            return 0;
+        }
+        mPos = 4;
+
+        quint32 version, stringCount, stringsOffset, bodyOffset, bodySize;
+        readU32(version);
+        readU32(stringCount);
+        readU32(stringsOffset);
+        readU32(bodyOffset);
+        readU32(bodySize);
+        if (version != PZSB_VERSION) {
+            mError = tr("Unsupported binary script version %1").arg(version);
+            return 0;
+        }
+
+        qint64 offsetsSize = (qint64(stringCount) + 1) * 4;
+        if (stringsOffset > size || offsetsSize > size - stringsOffset)
+            return corrupt();
+        mStringOffsets = data + stringsOffset;
+        mStringData = mStringOffsets + offsetsSize;
+        mStringDataSize = qFromLittleEndian<quint32>(mStringOffsets + stringCount * 4);
+        if (mStringDataSize > size - stringsOffset - offsetsSize)
+            return corrupt();
+        mStrings.resize(stringCount);
+        mDecoded = QBitArray(stringCount);
+
+        if (bodyOffset > size || bodySize > size - bodyOffset)
+            return corrupt();
+        mPos = bodyOffset;
+        mEnd = qint64(bodyOffset) + bodySize;
+
+        Project *project = readProject();
+        if (project)
+            project->rootNode()->setLabel(QFileInfo(path).baseName());
+        return project;
+    }
+
+    QString errorString() const
+    {
+        return mError;
+    }
+
+private:
+    Project *readProject()
+    {
+        Project *project = new Project();
+        ScriptNode *root = project->rootNode();
+        mReceivers.clear();
+
+        quint32 version, count;
+        if (!readU32(version) || !readVariables(root, true) || !readInputs(root, true)
+                || !readOutputs(root, true) || !readConnections(root)
+                || !readU32(count)) {
+            delete project;
+            return 0;
+        }
+
+        int nextID = project->mNextID;
+        for (quint32 i = 0; i < count; i++) {
+            BaseNode *node = readNode();
+            if (!node) {
+                delete project;
+                return 0;
+            }
+            root->insertNode(root->nodeCount(), node);
+            if (node->id() >= nextID)
+                nextID = node->id() + 1;
+        }
+        project->mNextID = nextID;
+
+        if (!resolveReferences(project)) {
+            delete project;
+            return 0;
+        }
+
+        return project;
+    }
+
+    BaseNode *readNode()
+    {
+        quint8 kind;
+        qint32 id;
+        QString label, eventName, source;
+        double x, y;
+        if (!readU8(kind) || !readI32(id) || !readString(label))
+            return 0;
+        if (id < 0) {
+            mError = tr("missing or invalid node ID");
+            return 0;
+        }
+
+        if (kind == PZSB_EVENT_NODE) {
+            if (!readString(eventName))
+                return 0;
+            if (eventName.isEmpty()) {
+                mError = tr("Empty or missing event name");
+                return 0;
+            }
+        } else if (kind != PZSB_LUA_NODE && kind != PZSB_SCRIPT_NODE) {
+            mError = tr("Unknown node type %1").arg(kind);
+            return 0;
+        }
+
+        if (!readF64(x) || !readF64(y) || !readString(source))
+            return 0;
+        source = resolveReference(source, mRelativeTo);
+
+        BaseNode *node;
+        if (kind == PZSB_EVENT_NODE) {
+            MetaEventNode *enode = new MetaEventNode(id, eventName,
+                                                     label.isEmpty() ? eventName : label);
+            enode->setSource(source);
+            node = enode;
+        } else if (kind == PZSB_LUA_NODE) {
+            LuaNode *lnode = new LuaNode(id, label);
+            lnode->setSource(source);
+            node = lnode;
+        } else {
+            ScriptNode *snode = new ScriptNode(id, label);
+            snode->setSource(source);
+            node = snode;
+        }
+        node->setPos(x, y);
+
+        bool ok = readVariables(node, false);
+        if (ok && kind != PZSB_EVENT_NODE)
+            ok = readInputs(node, false) && readOutputs(node, false);
+        if (ok)
+            ok = readConnections(node);
+        if (!ok) {
+            delete node;
+            return 0;
+        }
+
+        return node;
+    }
+
+    bool readVariables(BaseNode *node, bool rootNode)
+    {
+        quint32 count;
+        if (!readU32(count))
+            return false;
+        for (quint32 i = 0; i < count; i++) {
+            QString type, name, label;
+            quint8 kind;
+            if (!readString(type) || !readString(name) || !readString(label) || !readU8(kind))
+                return false;
+            if (!rootNode)
+                label = name;
+            ScriptVariable *var;
+            if (kind == PZSB_VALUE) {
+                QString value;
+                if (!readString(value))
+                    return false;
+                var = new ScriptVariable(type, name, label, value);
+            } else if (kind == PZSB_REFERENCE) {
+                qint32 refID;
+                QString refVar;
+                if (!readI32(refID) || !readString(refVar))
+                    return false;
+                var = new ScriptVariable(type, name, name, refID, refVar);
+            } else {
+                mError = tr("Unknown variable kind %1").arg(kind);
+                return false;
+            }
+            node->insertVariable(node->variableCount(), var);
+        }
+        return true;
+    }
+
+    bool readInputs(BaseNode *node, bool rootNode)
+    {
+        quint32 count;
+        if (!readU32(count))
+            return false;
+        for (quint32 i = 0; i < count; i++) {
+            QString name, label;
+            if (!readString(name) || !readString(label))
+                return false;
+            if (name.isEmpty()) {
+                mError = tr("Empty or missing input name");
+                return false;
+            }
+            if (!rootNode || label.isEmpty())
+                label = name;
+            node->insertInput(node->inputCount(), new NodeInput(name, label));
+        }
+        return true;
+    }
+
+    bool readOutputs(BaseNode *node, bool rootNode)
+    {
+        quint32 count;
+        if (!readU32(count))
+            return false;
+        for (quint32 i = 0; i < count; i++) {
+            QString name, label;
+            if (!readString(name) || !readString(label))
+                return false;
+            if (name.isEmpty()) {
+                mError = tr("Empty or missing output name");
+                return false;
+            }
+            if (!rootNode || label.isEmpty())
+                label = name;
+            node->insertOutput(node->outputCount(), new NodeOutput(name, label));
+        }
+        return true;
+    }
+
+    bool readConnections(BaseNode *node)
+    {
+        quint32 count;
+        if (!readU32(count))
+            return false;
+        for (quint32 i = 0; i < count; i++) {
+            QString outputName, inputName;
+            qint32 rcvr;
+            quint32 pointCount;
+            if (!readString(outputName) || !readI32(rcvr) || !readString(inputName)
+                    || !readU32(pointCount))
+                return false;
+            if (rcvr < 0) {
+                mError = tr("Invalid receiver \"%1\"").arg(rcvr);
+                return false;
+            }
+            if (pointCount > (mEnd - mPos) / 16) {
+                corrupt();
+                return false;
+            }
+            QPolygonF points(pointCount);
+            for (quint32 j = 0; j < pointCount; j++) {
+                double x, y;
+                readF64(x);
+                readF64(y);
+                points[j] = QPointF(x, y);
+            }
+
+            NodeConnection *cxn = new NodeConnection;
+            cxn->mSender = node;
+            cxn->mOutput = outputName;
+            cxn->mInput = inputName;
+            cxn->mReceiver = 0;
+            cxn->mControlPoints = points;
+            node->insertConnection(node->connectionCount(), cxn);
+            mReceivers += qMakePair(cxn, int(rcvr));
+        }
+        return true;
+    }
+
+    bool resolveReferences(Project *project)
+    {
+        foreach (BaseNode *node, project->rootNode()->nodesPlusSelf()) {
+            foreach (ScriptVariable *var, node->variables()) {
+                if (var->variableRef().length()) {
+                    if (!project->rootNode()->nodeByID(var->variableRefID())) {
+                        mError = tr("Invalid referenceid \"%1\" (unknown node)").arg(var->variableRefID());
+                        return false;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < mReceivers.size(); i++) {
+            int id = mReceivers[i].second;
+            if (BaseNode *rcvr = project->rootNode()->nodeByID(id)) {
+                mReceivers[i].first->mReceiver = rcvr;
+            } else {
+                mError = tr("Invalid receiver \"%1\"").arg(id);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Project *corrupt()
+    {
+        mError = tr("The binary script file is corrupt.");
+        return 0;
+    }
+
+    bool need(qint64 bytes)
+    {
+        if (mPos + bytes <= mEnd)
+            return true;
+        if (mError.isEmpty())
+            corrupt();
+        return false;
+    }
+
+    bool readU8(quint8 &v)
+    {
+        if (!need(1))
+            return false;
+        v = mData[mPos++];
+        return true;
+    }
+
+    bool readU32(quint32 &v)
+    {
+        if (!need(4))
+            return false;
+        v = qFromLittleEndian<quint32>(mData + mPos);
+        mPos += 4;
+        return true;
+    }
+
+    bool readI32(qint32 &v)
+    {
+        quint32 u;
+        if (!readU32(u))
+            return false;
+        v = qint32(u);
+        return true;
+    }
+
+    bool readF64(double &v)
+    {
+        if (!need(8))
+            return false;
+        quint64 u = qFromLittleEndian<quint64>(mData + mPos);
+        memcpy(&v, &u, sizeof(v));
+        mPos += 8;
+        return true;
+    }
+
+    bool readString(QString &s)
+    {
+        quint32 index;
+        if (!readU32(index))
+            return false;
+        if (index == PZSB_NO_STRING) {
+            s = QString();
+            return true;
+        }
+        if (index >= quint32(mStrings.size())) {
+            corrupt();
+            return false;
+        }
+        if (!mDecoded.testBit(index)) {
+            quint32 start = qFromLittleEndian<quint32>(mStringOffsets + index * 4);
+            quint32 end = qFromLittleEndian<quint32>(mStringOffsets + index * 4 + 4);
+            if (start > end || end > mStringDataSize) {
+                corrupt();
+                return false;
+            }
+            mStrings[index] = QString::fromUtf8((const char *) mStringData + start, end - start);
+            mDecoded.setBit(index);
+        }
+        s = mStrings[index];
+        return true;
+    }
+
+    const uchar *mData;
+    qint64 mPos;
+    qint64 mEnd;
+    const uchar *mStringOffsets;
+    const uchar *mStringData;
+    quint32 mStringDataSize;
+    QVector<QString> mStrings;
+    QBitArray mDecoded;
+    QList<QPair<NodeConnection*,int> > mReceivers;
+    QString mRelativeTo;
+    QString mError;
+};
+
+/////
 
 class ProjectReaderPrivate
 {
@@ -84,6 +502,29 @@ public:
         return project;
     }
 
+    Project *readBinaryProject(QFile *file, const QString &path)
+    {
+        mError.clear();
+        if (!file->open(QFile::ReadOnly)) {
+            mError = tr("Unable to read file: %1").arg(file->fileName());
+            return 0;
+        }
+
+        BinaryProjectReader reader;
+        Project *project;
+        if (uchar *data = file->map(0, file->size())) {
+            project = reader.read(data, file->size(), path);
+            file->unmap(data);
+        } else {
+            QByteArray bytes = file->readAll();
+            project = reader.read((const uchar *) bytes.constData(), bytes.size(), path);
+        }
+
+        if (!project)
+            mError = reader.errorString();
+        return project;
+    }
+
 private:
     Project *readProject()
     {
@@ -354,7 +795,7 @@ private:
                 label = name;
         }
         xml.skipCurrentElement();
-        return new NodeOutput(name);
+        return new NodeOutput(name, label);
     }
 
     NodeConnection *readConnection(BaseNode *node)
@@ -415,23 +856,6 @@ private:
         xml.skipCurrentElement();
     }
 
-    QString resolveReference(const QString &fileName, const QString &relativeTo)
-    {
-//        qDebug() << "resolveReference" << fileName << "relative to" << relativeTo;
-        if (fileName.isEmpty())
-            return fileName;
-        if (fileName == QLatin1String("."))
-            return relativeTo;
-        if (QDir::isRelativePath(fileName)) {
-            QString path = QDir(relativeTo).filePath(fileName);
-            QFileInfo info(path);
-            if (info.exists())
-                return info.canonicalFilePath();
-            return QDir::cleanPath(path);
-        }
-        return fileName;
-    }
-
     QString getRelativeFile(const QXmlStreamAttributes &atts, const QString &name)
     {
         QString s = atts.value(name).toString();
@@ -534,6 +958,11 @@ Project *ProjectReader::read(const QString &fileName)
     if (!d->openFile(&file))
         return 0;
 
+    if (file.peek(4) == PZSB_MAGIC) {
+        file.close();
+        return d->readBinaryProject(&file, fileName);
+    }
+
     return d->readProject(&file, fileName);
 }
 
@@ -30,6 +30,7 @@ public:
     ProjectReader();
     ~ProjectReader();
 
+    // Reads either the XML or the binary format.
     Project *read(const QString &fileName);
 
     QString errorString() const;
@@ -21,14 +21,234 @@
 #include "metaeventmanager.h"
 #include "node.h"
 #include "project.h"
+#include "projectbinary.h"
 #include "scriptmanager.h"
 
 #include <QCoreApplication>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QTemporaryFile>
 #include <QXmlStreamWriter>
+#include <QtEndian>
+
+#include <string.h>
+
+// Writes the .pzsb format described in projectbinary.h.
+class BinaryProjectWriter
+{
+public:
+    BinaryProjectWriter()
+        : mProject(0)
+    {
+    }
+
+    QByteArray write(Project *project, const QString &absDirPath)
+    {
+        mMapDir = QDir(absDirPath);
+        mProject = project;
+        mBody.clear();
+        mStrings.clear();
+        mStringIndex.clear();
+
+        writeU32(1); // script version
+
+        ScriptNode *node = project->rootNode();
+        writeVariables(node);
+        writeInputs(node);
+        writeOutputs(node);
+        writeConnections(node);
+        writeU32(node->nodeCount());
+        foreach (BaseNode *child, node->nodes())
+            writeNode(child);
+
+        QByteArray stringData;
+        QByteArray offsets;
+        foreach (const QByteArray &utf8, mStrings) {
+            appendU32(offsets, stringData.size());
+            stringData += utf8;
+        }
+        appendU32(offsets, stringData.size());
+
+        quint32 stringsOffset = PZSB_HEADER_SIZE;
+        quint32 bodyOffset = stringsOffset + offsets.size() + stringData.size();
+        bodyOffset = (bodyOffset + 7) & ~7;
+
+        QByteArray data(PZSB_MAGIC);
+        appendU32(data, PZSB_VERSION);
+        appendU32(data, mStrings.size());
+        appendU32(data, stringsOffset);
+        appendU32(data, bodyOffset);
+        appendU32(data, mBody.size());
+        data += offsets;
+        data += stringData;
+        data += QByteArray(bodyOffset - data.size(), '\0');
+        data += mBody;
+        return data;
+    }
+
+private:
+    void writeNode(BaseNode *node)
+    {
+        if (MetaEventNode *enode = node->asEventNode()) {
+            writeU8(PZSB_EVENT_NODE);
+            writeI32(node->id());
+            writeString(node->label());
+            writeString(enode->eventName());
+            writePos(node->pos());
+            writeString(relativeFileName(enode->info()
+                                         ? enode->info()->path()
+                                         : enode->source()));
+            writeVariables(node);
+            writeConnections(node);
+            return;
+        }
+
+        if (LuaNode *lnode = node->asLuaNode()) {
+            writeU8(PZSB_LUA_NODE);
+            writeI32(node->id());
+            writeString(node->label());
+            writePos(node->pos());
+            writeString(relativeFileName(lnode->info()
+                                         ? lnode->info()->path()
+                                         : lnode->source()));
+        } else if (ScriptNode *snode = node->asScriptNode()) {
+            writeU8(PZSB_SCRIPT_NODE);
+            writeI32(node->id());
+            writeString(node->label());
+            writePos(node->pos());
+            writeString(relativeFileName(snode->info()
+                                         ? snode->info()->path()
+                                         : snode->source()));
+        }
+        writeVariables(node);
+        writeInputs(node);
+        writeOutputs(node);
+        writeConnections(node);
+    }
+
+    void writeVariables(BaseNode *node)
+    {
+        bool root = node == mProject->rootNode();
+        writeU32(node->variableCount());
+        foreach (ScriptVariable *var, node->variables()) {
+            writeString(var->type());
+            writeString(var->name());
+            writeString(root ? var->label() : QString());
+            if (var->variableRef().isEmpty()) {
+                writeU8(PZSB_VALUE);
+                writeString(var->value());
+            } else {
+                writeU8(PZSB_REFERENCE);
+                writeI32(var->variableRefID());
+                writeString(var->variableRef());
+            }
+        }
+    }
+
+    void writeInputs(BaseNode *node)
+    {
+        writeU32(node->inputCount());
+        foreach (NodeInput *input, node->inputs()) {
+            writeString(input->name());
+            writeString(node->isProjectRootNode() ? input->label() : QString());
+        }
+    }
+
+    void writeOutputs(BaseNode *node)
+    {
+        writeU32(node->outputCount());
+        foreach (NodeOutput *output, node->outputs()) {
+            writeString(output->name());
+            writeString(node->isProjectRootNode() ? output->label() : QString());
+        }
+    }
+
+    void writeConnections(BaseNode *node)
+    {
+        writeU32(node->connectionCount());
+        foreach (NodeConnection *cxn, node->connections()) {
+            writeString(cxn->mOutput);
+            writeI32(cxn->mReceiver->id());
+            writeString(cxn->mInput);
+            writeU32(cxn->mControlPoints.size());
+            foreach (const QPointF &p, cxn->mControlPoints)
+                writePos(p);
+        }
+    }
+
+    void writePos(const QPointF &pos)
+    {
+        writeF64(pos.x());
+        writeF64(pos.y());
+    }
+
+    void writeString(const QString &s)
+    {
+        if (s.isNull()) {
+            writeU32(PZSB_NO_STRING);
+            return;
+        }
+        if (!mStringIndex.contains(s)) {
+            mStringIndex[s] = mStrings.size();
+            mStrings += s.toUtf8();
+        }
+        writeU32(mStringIndex[s]);
+    }
+
+    void writeU8(quint8 v)
+    {
+        mBody += char(v);
+    }
+
+    void writeU32(quint32 v)
+    {
+        appendU32(mBody, v);
+    }
+
+    void writeI32(qint32 v)
+    {
+        appendU32(mBody, quint32(v));
+    }
+
+    void writeF64(double v)
+    {
+        // Round the same way the XML writer does, so converting between the
+        // formats doesn't change anything.
+        v = QString::number(v, 'f', 3).toDouble();
+        quint64 u;
+        memcpy(&u, &v, sizeof(u));
+        uchar buf[8];
+        qToLittleEndian<quint64>(u, buf);
+        mBody.append((const char *) buf, 8);
+    }
+
+    static void appendU32(QByteArray &ba, quint32 v)
+    {
+        uchar buf[4];
+        qToLittleEndian<quint32>(v, buf);
+        ba.append((const char *) buf, 4);
+    }
+
+    QString relativeFileName(const QString &path)
+    {
+        if (!path.isEmpty()) {
+            QFileInfo fi(path);
+            if (fi.isAbsolute())
+                return mMapDir.relativeFilePath(path);
+        }
+        return path;
+    }
+
+    Project *mProject;
+    QDir mMapDir;
+    QByteArray mBody;
+    QList<QByteArray> mStrings;
+    QHash<QString,quint32> mStringIndex;
+};
+
+/////
 
 class ProjectWriterPrivate
 {
@@ -287,7 +507,11 @@ bool ProjectWriter::write(Project *project, const QString &filePath)
     if (!d->openFile(&tempFile))
         return false;
 
-    d->writeProject(project, &tempFile, QFileInfo(filePath).absolutePath());
+    QString absDirPath = QFileInfo(filePath).absolutePath();
+    if (filePath.endsWith(QLatin1String(".pzsb"), Qt::CaseInsensitive))
+        tempFile.write(BinaryProjectWriter().write(project, absDirPath));
+    else
+        d->writeProject(project, &tempFile, absDirPath);
 
     if (tempFile.error() != QFile::NoError) {
         d->mError = tempFile.errorString();
@@ -30,6 +30,8 @@ public:
     ProjectWriter();
     ~ProjectWriter();
 
+    // A filePath ending in .pzsb is written in the binary format, anything
+    // else as XML.
     bool write(Project *project, const QString &filePath);
 
     QString errorString() const;
@@ -51,13 +51,27 @@ ScriptInfo *ScriptManager::scriptInfo(const QString &fileName, const QString &re
     if (!node)
         return 0;
 
+    insertScript(path, node);
+    return mScriptInfo[path];
+}
+
+QSet<QString> ScriptManager::loadedPaths() const
+{
+    return QSet<QString>::fromList(mScriptInfo.keys());
+}
+
+void ScriptManager::insertScript(const QString &path, ScriptNode *node)
+{
+    if (mScriptInfo.contains(path)) {
+        delete node;
+        return;
+    }
+
     ScriptInfo *info = new ScriptInfo;
     info->mPath = path;
     info->mNode = node;
     mScriptInfo[path] = info;
     mFileSystemWatcher.addPath(path);
-
-    return info;
 }
 
 QString ScriptManager::canonicalPath(const QString &fileName, const QString &relativeTo)
@@ -96,12 +110,17 @@ void ScriptManager::fileChangedTimeout()
             if (info.exists()) {
                 mFileSystemWatcher.addPath(path);
                 ScriptInfo *scriptInfo = mScriptInfo[path];
-                delete scriptInfo->mNode;
+                ScriptNode *oldNode = scriptInfo->mNode;
                 scriptInfo->mNode = loadScript(path);
                 if (!scriptInfo->mNode) {
                     // ???
                 }
-                emit infoChanged(scriptInfo);
+                // Nodes using this script only need syncing if its inputs,
+                // outputs or variables changed.
+                bool changed = !scriptInfo->mNode || !scriptInfo->mNode->sameSignature(oldNode);
+                delete oldNode;
+                if (changed)
+                    emit infoChanged(scriptInfo);
             }
         }
     }
@@ -45,7 +45,16 @@ public:
     explicit ScriptManager(QObject *parent = 0);
 
     ScriptInfo *scriptInfo(const QString &fileName, const QString &relativeTo = QString());
-    QString canonicalPath(const QString &fileName, const QString &relativeTo = QString());
+    static QString canonicalPath(const QString &fileName, const QString &relativeTo = QString());
+
+    QSet<QString> loadedPaths() const;
+
+    // Takes ownership of a script read by loadScript() on another thread.
+    void insertScript(const QString &path, ScriptNode *node);
+
+    // Doesn't touch any ScriptManager state, so it may be called from any
+    // thread.
+    static ScriptNode *loadScript(const QString &path);
 
 signals:
     void infoChanged(ScriptInfo *info);
@@ -54,9 +63,6 @@ public slots:
     void fileChanged(const QString &path);
     void fileChangedTimeout();
 
-private:
-    ScriptNode *loadScript(const QString &path);
-
 private:
     QMap<QString,ScriptInfo*> mScriptInfo;
 
@@ -21,6 +21,7 @@
 #include "metaeventmanager.h"
 #include "node.h"
 #include "nodeitem.h"
+#include "preferences.h"
 #include "project.h"
 #include "projectactions.h"
 #include "projectchanger.h"
@@ -28,12 +29,16 @@
 #include "scriptmanager.h"
 
 #include <QApplication>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QFontMetrics>
 #include <QGraphicsSceneDragDropEvent>
+#include <QGraphicsView>
 #include <QMenu>
 #include <QStyleOptionGraphicsItem>
 #include <QMimeData>
 #include <QPainter>
+#include <QSet>
 #include <QUrl>
 #include <QVector2D>
 #include <QtMath>
@@ -53,8 +58,11 @@ ScriptScene::ScriptScene(ProjectDocument *doc, QObject *parent) :
     addItem(mAreaItem);
 
 #if 1
-    foreach (BaseNode *node, doc->project()->rootNode()->nodes()) {
-        mNodeItems += createItemForNode(node);
+    // Items for the nodes are created a few at a time by populateSome() so
+    // that opening a large script doesn't freeze the GUI.
+    for (int i = 0; i < doc->project()->rootNode()->nodeCount(); i++) {
+        mNodeItems += 0;
+        mPendingNodes += i;
     }
 #elif 0
     if (DraftDefinition *dt = new DraftDefinition(tr("CheckInventoryItem"))) {
@@ -184,6 +192,13 @@ ScriptScene::ScriptScene(ProjectDocument *doc, QObject *parent) :
     connect(scriptmgr(), SIGNAL(infoChanged(ScriptInfo*)),
             SLOT(infoChanged(ScriptInfo*)));
 
+    int connectionCount = mDocument->project()->rootNode()->connectionCount();
+    foreach (BaseNode *node, mDocument->project()->rootNode()->nodes())
+        connectionCount += node->connectionCount();
+    int threshold = prefs()->batchedConnectionsThreshold();
+    if (threshold > 0 && connectionCount >= threshold)
+        mConnectionsItem->setBatched(true);
+
     int index = 0;
     foreach (NodeConnection *cxn, mDocument->project()->rootNode()->connections())
         mConnectionsItem->afterAddConnection(index++, cxn);
@@ -193,6 +208,12 @@ ScriptScene::ScriptScene(ProjectDocument *doc, QObject *parent) :
         foreach (NodeConnection *cxn, node->connections())
             mConnectionsItem->afterAddConnection(index++, cxn);
     }
+
+    // The first slice runs from the event loop, by which time the scene has
+    // its view and the visible nodes can be created first.
+    mPopulateTimer.setInterval(0);
+    connect(&mPopulateTimer, SIGNAL(timeout()), SLOT(populateSome()));
+    mPopulateTimer.start();
 }
 
 void ScriptScene::setTool(AbstractTool *tool)
@@ -212,11 +233,49 @@ NodeItem *ScriptScene::createItemForNode(BaseNode *node)
 
 NodeItem *ScriptScene::itemForNode(BaseNode *node)
 {
-    foreach (NodeItem *item, mNodeItems) {
-        if (item->node() == node)
-            return item;
+    return mItemByNode.value(node);
+}
+
+// Text less than this many pixels high on screen isn't drawn.
+#define LEGIBLE_TEXT_HEIGHT 5
+
+bool ScriptScene::isTextLegible(qreal lod)
+{
+    return lod >= LOD_SIMPLE && textBounds(QLatin1String("X")).height() * lod >= LEGIBLE_TEXT_HEIGHT;
+}
+
+// Labels are measured over and over while laying out nodes and ports, so
+// remember the results until the scene's font changes.
+#define TEXT_BOUNDS_CACHE_MAX 20000
+
+QRect ScriptScene::textBounds(const QString &text)
+{
+    if (font() != mMetricsFont || mTextBounds.size() > TEXT_BOUNDS_CACHE_MAX) {
+        mMetricsFont = font();
+        mTextBounds.clear();
+        mTextBoundsF.clear();
     }
-    return 0;
+    QHash<QString,QRect>::const_iterator it = mTextBounds.constFind(text);
+    if (it != mTextBounds.constEnd())
+        return *it;
+    QRect r = QFontMetrics(mMetricsFont).boundingRect(text);
+    mTextBounds.insert(text, r);
+    return r;
+}
+
+QRectF ScriptScene::textBoundsF(const QString &text)
+{
+    if (font() != mMetricsFont || mTextBoundsF.size() > TEXT_BOUNDS_CACHE_MAX) {
+        mMetricsFont = font();
+        mTextBounds.clear();
+        mTextBoundsF.clear();
+    }
+    QHash<QString,QRectF>::const_iterator it = mTextBoundsF.constFind(text);
+    if (it != mTextBoundsF.constEnd())
+        return *it;
+    QRectF r = QFontMetricsF(mMetricsFont).boundingRect(text);
+    mTextBoundsF.insert(text, r);
+    return r;
 }
 
 QRectF ScriptScene::boundsOfAllNodes()
@@ -224,6 +283,8 @@ QRectF ScriptScene::boundsOfAllNodes()
     QRectF r;
 
     foreach (NodeItem *item, mNodeItems) {
+        if (!item)
+            continue;
         QRectF r2 = item->mapRectToScene(item->boundingRect()) |
                 item->mapRectToScene(item->childrenBoundingRect());
         if (r.isEmpty())
@@ -231,6 +292,16 @@ QRectF ScriptScene::boundsOfAllNodes()
         else
             r |= r2;
     }
+
+    // Only the position of a pending node is known.
+    const QList<BaseNode*> &nodes = mDocument->project()->rootNode()->nodes();
+    foreach (int index, mPendingNodes) {
+        QRectF r2(nodes[index]->pos(), QSizeF(1, 1));
+        if (r.isEmpty())
+            r = r2;
+        else
+            r |= r2;
+    }
     if (!r.isEmpty())
         r.adjust(-64, -64, 64, 64);
     return r;
@@ -464,38 +535,49 @@ void ScriptScene::sceneRectChanged()
 
 void ScriptScene::afterAddNode(int index, BaseNode *node)
 {
-    mNodeItems.insert(index, createItemForNode(node));
+    finishPopulating();
+    insertNodeItem(index, createItemForNode(node));
     mConnectionsItem->afterAddNode(index, node);
     mAreaItem->updateBounds();
+    variableRefsChanged(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterRemoveNode(int index, BaseNode *node)
 {
     Q_UNUSED(node)
-    delete mNodeItems.takeAt(index);
+    finishPopulating();
+    removeNodeItem(index);
     mConnectionsItem->afterRemoveNode(index, node);
     mAreaItem->updateBounds();
+    variableRefsChanged(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterMoveNode(BaseNode *node, const QPointF &oldPos)
 {
     Q_UNUSED(oldPos)
+    finishPopulating();
     if (NodeItem *item = itemForNode(node))
         item->setPos(node->pos());
     else
         Q_ASSERT(false);
     mAreaItem->updateBounds();
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterRenameNode(BaseNode *node, const QString &oldName)
 {
     Q_UNUSED(oldName)
+    finishPopulating();
     if (NodeItem *item = itemForNode(node))
         item->updateLayout();
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::inputsChanged(BaseNode *node)
 {
+    finishPopulating();
     if (node == document()->project()->rootNode()) {
         mAreaItem->mInputsItem->syncWithNode();
         mAreaItem->mInputsItem->updateLayout();
@@ -505,11 +587,13 @@ void ScriptScene::inputsChanged(BaseNode *node)
                 item->inputsChanged();
     }
 
-    mConnectionsItem->updateConnections();
+    mConnectionsItem->updateConnections(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::outputsChanged(BaseNode *node)
 {
+    finishPopulating();
     if (node == document()->project()->rootNode()) {
         mAreaItem->mOutputsItem->syncWithNode();
         mAreaItem->mOutputsItem->updateLayout();
@@ -519,7 +603,8 @@ void ScriptScene::outputsChanged(BaseNode *node)
                 item->outputsChanged();
     }
 
-    mConnectionsItem->updateConnections();
+    mConnectionsItem->updateConnections(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::inputsChanged()
@@ -534,75 +619,222 @@ void ScriptScene::outputsChanged()
 
 void ScriptScene::afterAddConnection(int index, NodeConnection *cxn)
 {
+    finishPopulating();
     mConnectionsItem->afterAddConnection(index, cxn);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterRemoveConnection(int index, NodeConnection *cxn)
 {
+    finishPopulating();
     mConnectionsItem->afterRemoveConnection(index, cxn);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterSetControlPoints(NodeConnection *cxn, const QPolygonF &oldPoints)
 {
     Q_UNUSED(oldPoints)
+    finishPopulating();
     mConnectionsItem->afterSetControlPoints(cxn);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterChangeVariable(ScriptVariable *var, const ScriptVariable *oldValue)
 {
     Q_UNUSED(oldValue)
+    finishPopulating();
     foreach (NodeItem *nodeItem, mNodeItems)
         if (nodeItem->displaysVariable(var)) {
             nodeItem->updateLayout();
         }
+    variableRefsChanged(var->node());
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterAddVariable(BaseNode *node, int index, ScriptVariable *var)
 {
     Q_UNUSED(index)
     Q_UNUSED(var)
+    finishPopulating();
     foreach (NodeItem *nodeItem, mNodeItems)
         if (nodeItem->node() == node)
             nodeItem->variablesChanged();
+    variableRefsChanged(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::afterRemoveVariable(BaseNode *node, int index, ScriptVariable *var)
 {
     Q_UNUSED(index)
     Q_UNUSED(var)
+    finishPopulating();
     foreach (NodeItem *nodeItem, mNodeItems)
         if (nodeItem->node() == node)
             nodeItem->variablesChanged();
+    variableRefsChanged(node);
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::infoChanged(MetaEventInfo *info)
 {
-    foreach (NodeItem *item, mNodeItems)
+    finishPopulating();
+    QList<NodeItem*> items = mNodeItemsByInfo.values(info);
+    if (items.isEmpty())
+        return;
+
+    foreach (NodeItem *item, items)
         item->infoChanged(info);
 
     mAreaItem->updateBounds();
 
-    mConnectionsItem->updateConnections();
+    foreach (NodeItem *item, items) {
+        mConnectionsItem->updateConnections(item->node());
+        variableRefsChanged(item->node());
+    }
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::infoChanged(ScriptInfo *info)
 {
-    foreach (NodeItem *item, mNodeItems)
+    finishPopulating();
+    QList<NodeItem*> items = mNodeItemsByInfo.values(info);
+    if (items.isEmpty())
+        return;
+
+    foreach (NodeItem *item, items)
         item->infoChanged(info);
 
     mAreaItem->updateBounds();
 
-    mConnectionsItem->updateConnections();
+    foreach (NodeItem *item, items) {
+        mConnectionsItem->updateConnections(item->node());
+        variableRefsChanged(item->node());
+    }
+    emit contentsChanged(QRectF());
 }
 
 void ScriptScene::infoChanged(LuaInfo *info)
 {
-    foreach (NodeItem *item, mNodeItems)
+    finishPopulating();
+    QList<NodeItem*> items = mNodeItemsByInfo.values(info);
+    if (items.isEmpty())
+        return;
+
+    foreach (NodeItem *item, items)
         item->infoChanged(info);
 
     mAreaItem->updateBounds();
 
-    mConnectionsItem->updateConnections();
+    foreach (NodeItem *item, items) {
+        mConnectionsItem->updateConnections(item->node());
+        variableRefsChanged(item->node());
+    }
+    emit contentsChanged(QRectF());
+}
+
+// The info a node gets its inputs, outputs and variables from.  A node's info
+// is set before the node is added to the project and never changes.
+static const void *infoForNode(BaseNode *node)
+{
+    if (MetaEventNode *enode = node->asEventNode())
+        return enode->info();
+    if (LuaNode *lnode = node->asLuaNode())
+        return lnode->info();
+    if (ScriptNode *snode = node->asScriptNode())
+        return snode->info();
+    return 0;
+}
+
+// Variable items are cached as pixmaps, those referring to a variable of the
+// given node are repainted in case the reference became valid or invalid.
+void ScriptScene::variableRefsChanged(BaseNode *node)
+{
+    foreach (NodeItem *nodeItem, mNodeItems)
+        if (nodeItem)
+            nodeItem->variableRefsChanged(node->id());
+}
+
+void ScriptScene::insertNodeItem(int index, NodeItem *item)
+{
+    mNodeItems.insert(index, item);
+    registerNodeItem(item);
+}
+
+void ScriptScene::registerNodeItem(NodeItem *item)
+{
+    mItemByNode[item->node()] = item;
+    if (const void *info = infoForNode(item->node()))
+        mNodeItemsByInfo.insert(info, item);
+}
+
+// Time spent creating node items before returning to the event loop.
+#define POPULATE_MSEC 15
+
+// Nodes in or near the view are created before the rest.  A node's position
+// is its top-left corner, so look a bit above and to the left of the view.
+#define POPULATE_VIEW_MARGIN 256
+
+void ScriptScene::populateSome()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!views().isEmpty()) {
+        QGraphicsView *view = views().first();
+        QRectF visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+        visible.adjust(-POPULATE_VIEW_MARGIN, -POPULATE_VIEW_MARGIN, 0, 0);
+        const QList<BaseNode*> &nodes = mDocument->project()->rootNode()->nodes();
+        QList<int> later;
+        foreach (int index, mPendingNodes) {
+            if (!timer.hasExpired(POPULATE_MSEC) && visible.contains(nodes[index]->pos()))
+                populateNode(index);
+            else
+                later += index;
+        }
+        mPendingNodes = later;
+    }
+
+    int done = 0;
+    while (done < mPendingNodes.size() && !timer.hasExpired(POPULATE_MSEC))
+        populateNode(mPendingNodes[done++]);
+    mPendingNodes = mPendingNodes.mid(done);
+
+    mAreaItem->updateBounds();
+    emit contentsChanged(QRectF());
+
+    if (mPendingNodes.isEmpty())
+        mPopulateTimer.stop();
+}
+
+void ScriptScene::populateNode(int index)
+{
+    BaseNode *node = mDocument->project()->rootNode()->node(index);
+    NodeItem *item = createItemForNode(node);
+    mNodeItems[index] = item;
+    registerNodeItem(item);
+    mConnectionsItem->updateConnections(node);
+}
+
+// Node indices in the changer's signals only match mNodeItems once every
+// node has its item, so this is called before handling any change.
+void ScriptScene::finishPopulating()
+{
+    if (mPendingNodes.isEmpty())
+        return;
+    foreach (int index, mPendingNodes)
+        populateNode(index);
+    mPendingNodes.clear();
+    mPopulateTimer.stop();
+    mAreaItem->updateBounds();
+}
+
+void ScriptScene::removeNodeItem(int index)
+{
+    NodeItem *item = mNodeItems.takeAt(index);
+    mItemByNode.remove(item->node());
+    if (const void *info = infoForNode(item->node()))
+        mNodeItemsByInfo.remove(info, item);
+    delete item;
 }
 
 /////
@@ -610,6 +842,7 @@ void ScriptScene::infoChanged(LuaInfo *info)
 ConnectionItem::ConnectionItem(ProjectScene *scene, NodeConnection *cxn, QGraphicsItem *parent) :
     QGraphicsItem(parent),
     mScene(scene),
+    mShapeDirty(false),
     mConnection(cxn),
     mShowNodes(false),
     mControlPointIndex(-1),
@@ -631,7 +864,8 @@ void ConnectionItem::syncWithNodes()
         NodeInput *input = receiverItem ? receiverItem->node()->input(mConnection->mInput) : 0;
         to.input = input ? receiverItem->inputItem(input) : 0;
     } else {
-        NodeOutput *output = mConnection->mSender->output(mConnection->mOutput);
+        // The sender may not have an item yet while the scene is populating.
+        NodeOutput *output = senderItem ? mConnection->mSender->output(mConnection->mOutput) : 0;
         from.output = output ? senderItem->outputItem(output) : 0;
 
         if (mConnection->mReceiver->isProjectRootNode()) {
@@ -653,6 +887,7 @@ void ConnectionItem::updateBounds()
             prepareGeometryChange();
             mBounds = QRectF();
             mShape = QPainterPath();
+            mShapeDirty = false;
         }
         return;
     }
@@ -660,11 +895,8 @@ void ConnectionItem::updateBounds()
     mStartPoint = mConnectFrom.connectPosRight();
     mEndPoint = mConnectTo.connectPosLeft();
 
-    QPainterPath path;
-    path.addPolygon(allPoints());
-    QPainterPathStroker stroker;
-    stroker.setWidth(NODE_RADIUS * 2);
-    mShape = stroker.createStroke(path);
+    // The shape is only needed for hit-testing, build it when it's asked for.
+    mShapeDirty = true;
 
     QRectF bounds = allPoints().boundingRect().adjusted(-NODE_RADIUS, -NODE_RADIUS, NODE_RADIUS, NODE_RADIUS);
     bounds.adjust(-6, -6, 6, 6);
@@ -679,15 +911,24 @@ QRectF ConnectionItem::boundingRect() const
     return mBounds;
 }
 
-void ConnectionItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+void ConnectionItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
 {
     if (!mConnectFrom.isValid() || !mConnectTo.isValid())
         return;
 
-    painter->setRenderHint(QPainter::Antialiasing, true);
-
     bool highlight = mShowNodes && !ConnectionsItem::mMakingConnection;
 
+    if (ScriptScene::levelOfDetail(painter, option) < LOD_SIMPLE) {
+        QPen pen(highlight
+                 ? QColor(128, 255, 255, 200)
+                 : QColor(255, 255, 255, 200), 0);
+        painter->setPen(pen);
+        painter->drawPolyline(allPoints());
+        return;
+    }
+
+    painter->setRenderHint(QPainter::Antialiasing, true);
+
     QPen pen(highlight
              ? QColor(128, 255, 255, 200)
              : QColor(255, 255, 255, 200), 2);
@@ -727,9 +968,41 @@ void ConnectionItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *,
 
 QPainterPath ConnectionItem::shape() const
 {
+    if (mShapeDirty) {
+        QPainterPath path;
+        path.addPolygon(allPoints());
+        QPainterPathStroker stroker;
+        stroker.setWidth(NODE_RADIUS * 2);
+        mShape = stroker.createStroke(path);
+        mShapeDirty = false;
+    }
     return mShape;
 }
 
+static qreal distanceToSegment(const QPointF &p, const QPointF &a, const QPointF &b)
+{
+    QPointF ab = b - a;
+    qreal lengthSquared = ab.x() * ab.x() + ab.y() * ab.y();
+    qreal t = 0;
+    if (lengthSquared > 0) {
+        t = ((p.x() - a.x()) * ab.x() + (p.y() - a.y()) * ab.y()) / lengthSquared;
+        t = qBound(qreal(0), t, qreal(1));
+    }
+    return QLineF(p, a + ab * t).length();
+}
+
+// Same as testing against shape() but without building the stroke.
+bool ConnectionItem::contains(const QPointF &point) const
+{
+    if (mBounds.isEmpty() || !mBounds.contains(point))
+        return false;
+    QPolygonF poly = allPoints();
+    for (int i = 0; i < poly.size() - 1; i++)
+        if (distanceToSegment(point, poly[i], poly[i+1]) <= NODE_RADIUS)
+            return true;
+    return false;
+}
+
 void ConnectionItem::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
 {
     Q_UNUSED(event)
@@ -897,6 +1170,8 @@ bool ConnectionsItem::mMakingConnection = false;
 ConnectionsItem::ConnectionsItem(ProjectScene *scene, QGraphicsItem *parent) :
     QGraphicsItem(parent),
     mScene(scene),
+    mBatched(false),
+    mActiveItem(0),
     mNewConnectionItem(new QGraphicsPathItem)
 {
     setFlag(ItemHasNoContents);
@@ -905,20 +1180,178 @@ ConnectionsItem::ConnectionsItem(ProjectScene *scene, QGraphicsItem *parent) :
     mNewConnectionItem->setPen(pen);
 }
 
+ConnectionsItem::~ConnectionsItem()
+{
+    // Batched items aren't children, except the active one.
+    if (mBatched) {
+        foreach (ConnectionItem *item, mConnectionItems)
+            if (item != mActiveItem)
+                delete item;
+    }
+}
+
+void ConnectionsItem::setBatched(bool batched)
+{
+    Q_ASSERT(mConnectionItems.isEmpty());
+    mBatched = batched;
+    setFlag(ItemHasNoContents, !batched);
+    setFlag(ItemUsesExtendedStyleOption, batched);
+    setAcceptHoverEvents(batched);
+}
+
+QRectF ConnectionsItem::boundingRect() const
+{
+    return mBatched ? mBatchBounds : QRectF();
+}
+
+// Size of a cell in the batched-mode grid, in scene units.
+#define BATCH_CELL_SIZE 256
+
+static inline quint64 cellKey(int x, int y)
+{
+    return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+static QRect cellsFor(const QRectF &r)
+{
+    return QRect(QPoint(qFloor(r.left() / BATCH_CELL_SIZE), qFloor(r.top() / BATCH_CELL_SIZE)),
+                 QPoint(qFloor(r.right() / BATCH_CELL_SIZE), qFloor(r.bottom() / BATCH_CELL_SIZE)));
+}
+
+void ConnectionsItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    if (!mBatched)
+        return;
+
+    QRectF exposed = option->exposedRect;
+    QRect cells = cellsFor(exposed);
+    QList<ConnectionItem*> items;
+    if (qint64(cells.width()) * cells.height() > mConnectionItems.size())
+        items = mConnectionItems;
+    else {
+        QSet<ConnectionItem*> seen;
+        for (int y = cells.top(); y <= cells.bottom(); y++) {
+            for (int x = cells.left(); x <= cells.right(); x++) {
+                foreach (ConnectionItem *item, mItemsByCell.values(cellKey(x, y))) {
+                    if (!seen.contains(item)) {
+                        seen.insert(item);
+                        items += item;
+                    }
+                }
+            }
+        }
+    }
+
+    painter->save();
+    foreach (ConnectionItem *item, items) {
+        if (item != mActiveItem && item->mBounds.intersects(exposed))
+            item->paint(painter, option, widget);
+    }
+    painter->restore();
+}
+
+// Only the connections are hit-tested, not the whole bounds.
+QPainterPath ConnectionsItem::shape() const
+{
+    return QPainterPath();
+}
+
+bool ConnectionsItem::contains(const QPointF &point) const
+{
+    return mBatched && connectionAt(point) != 0;
+}
+
+void ConnectionsItem::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
+{
+    setActiveItem(connectionAt(event->scenePos()));
+}
+
+void ConnectionsItem::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
+{
+    setActiveItem(connectionAt(event->scenePos()));
+}
+
+ConnectionItem *ConnectionsItem::connectionAt(const QPointF &scenePos) const
+{
+    QRect cell = cellsFor(QRectF(scenePos, QSizeF()));
+    foreach (ConnectionItem *item, mItemsByCell.values(cellKey(cell.x(), cell.y())))
+        if (item->contains(scenePos))
+            return item;
+    return 0;
+}
+
+void ConnectionsItem::indexItem(ConnectionItem *item)
+{
+    QRectF bounds = item->mBounds;
+    if (mIndexedBounds.contains(item)) {
+        if (mIndexedBounds[item] == bounds)
+            return;
+        unindexItem(item);
+    }
+    mIndexedBounds[item] = bounds;
+    if (bounds.isEmpty())
+        return;
+    QRect cells = cellsFor(bounds);
+    for (int y = cells.top(); y <= cells.bottom(); y++)
+        for (int x = cells.left(); x <= cells.right(); x++)
+            mItemsByCell.insert(cellKey(x, y), item);
+    if (!mBatchBounds.contains(bounds)) {
+        prepareGeometryChange();
+        mBatchBounds |= bounds;
+    }
+}
+
+void ConnectionsItem::unindexItem(ConnectionItem *item)
+{
+    QRectF bounds = mIndexedBounds.take(item);
+    if (bounds.isEmpty())
+        return;
+    QRect cells = cellsFor(bounds);
+    for (int y = cells.top(); y <= cells.bottom(); y++)
+        for (int x = cells.left(); x <= cells.right(); x++)
+            mItemsByCell.remove(cellKey(x, y), item);
+}
+
+// Puts the given connection in the scene so it gets hover and mouse events,
+// and hands the previous one back to the batch.
+void ConnectionsItem::setActiveItem(ConnectionItem *item)
+{
+    if (item == mActiveItem)
+        return;
+    if (mActiveItem) {
+        if (mActiveItem->mControlPointIndex != -1)
+            return; // being dragged
+        mScene->removeItem(mActiveItem);
+        indexItem(mActiveItem);
+        update(mActiveItem->mBounds);
+    }
+    mActiveItem = item;
+    if (mActiveItem) {
+        mActiveItem->setParentItem(this);
+        update(mActiveItem->mBounds);
+    }
+}
+
 void ConnectionsItem::updateConnections()
 {
     foreach (ConnectionItem *item, mConnectionItems) {
-        item->syncWithNodes();
-        item->updateBounds();
+        syncWithNodes(item);
+        updateBounds(item);
+    }
+}
+
+// Only the connections to or from the given node.
+void ConnectionsItem::updateConnections(BaseNode *node)
+{
+    foreach (ConnectionItem *item, mItemsByNode.values(node)) {
+        syncWithNodes(item);
+        updateBounds(item);
     }
 }
 
 ConnectionItem *ConnectionsItem::itemFor(NodeConnection *cxn)
 {
-    foreach (ConnectionItem *item, mConnectionItems)
-        if (item->mConnection == cxn)
-            return item;
-    return 0;
+    return mItemByConnection.value(cxn);
 }
 
 int ConnectionsItem::indexOf(NodeConnection *cxn)
@@ -931,27 +1364,42 @@ int ConnectionsItem::indexOf(NodeConnection *cxn)
 
 void ConnectionsItem::moved(NodeInputItem *item)
 {
-    foreach (ConnectionItem *cxnItem, mConnectionItems) {
-        if (cxnItem->mConnectFrom.item() == item || cxnItem->mConnectTo.item() == item) {
-            cxnItem->updateBounds();
-            cxnItem->update();
-        }
-    }
+    movedPort(item);
 }
 
 void ConnectionsItem::moved(NodeOutputItem *item)
 {
-    foreach (ConnectionItem *cxnItem, mConnectionItems) {
-        if (cxnItem->mConnectFrom.item() == item || cxnItem->mConnectTo.item() == item) {
-            cxnItem->updateBounds();
-            cxnItem->update();
-        }
-    }
+    movedPort(item);
+}
+
+void ConnectionsItem::movedPort(QGraphicsItem *item)
+{
+    foreach (ConnectionItem *cxnItem, mItemsByPort.values(item))
+        updateBounds(cxnItem);
+}
+
+// Node items are cached and draw differently while a connection is being
+// made, so the ones under the mouse must be told when that starts or stops.
+static void updateUnderMouse(QGraphicsItem *item)
+{
+    if (!item->isUnderMouse())
+        return;
+    item->update();
+    foreach (QGraphicsItem *child, item->childItems())
+        updateUnderMouse(child);
+}
+
+void ConnectionsItem::setMakingConnection(bool making)
+{
+    mMakingConnection = making;
+    foreach (NodeItem *item, mScene->nodeItems())
+        if (item)
+            updateUnderMouse(item);
 }
 
 void ConnectionsItem::newConnectionStart(const QPointF &scenePos)
 {
-    mMakingConnection = true;
+    setMakingConnection(true);
 
     mNewConnectionPoints.clear();
     mNewConnectionPoints += scenePos;
@@ -981,13 +1429,13 @@ void ConnectionsItem::newConnectionClick(const QPointF &scenePos)
 
 void ConnectionsItem::newConnectionEnd()
 {
-    mMakingConnection = false;
+    setMakingConnection(false);
     mScene->removeItem(mNewConnectionItem);
 }
 
 void ConnectionsItem::newConnectionCancel()
 {
-    mMakingConnection = false;
+    setMakingConnection(false);
     mScene->removeItem(mNewConnectionItem);
 }
 
@@ -1000,31 +1448,104 @@ void ConnectionsItem::afterAddNode(int index, BaseNode *node)
 void ConnectionsItem::afterRemoveNode(int index, BaseNode *node)
 {
     Q_UNUSED(index)
-    foreach (NodeConnection *cxn, node->connections())
-        delete itemFor(cxn);
+    foreach (NodeConnection *cxn, node->connections()) {
+        index = indexOf(cxn);
+        if (index != -1)
+            deleteConnectionItem(index);
+    }
 }
 
 void ConnectionsItem::afterAddConnection(int index, NodeConnection *cxn)
 {
-    ConnectionItem *item = new ConnectionItem(mScene, cxn, this);
+    Q_UNUSED(index)
+    ConnectionItem *item = new ConnectionItem(mScene, cxn, mBatched ? 0 : this);
     mConnectionItems += item;
-    item->syncWithNodes();
-    item->updateBounds();
+    mItemByConnection[cxn] = item;
+    mItemsByNode.insert(cxn->mSender, item);
+    if (cxn->mReceiver != cxn->mSender)
+        mItemsByNode.insert(cxn->mReceiver, item);
+    syncWithNodes(item);
+    updateBounds(item);
 }
 
 void ConnectionsItem::afterRemoveConnection(int index, NodeConnection *cxn)
 {
     index = indexOf(cxn);
-    if (index != -1)
-        delete mConnectionItems.takeAt(index);
+    if (index != -1) {
+        updatePorts(mConnectionItems[index]);
+        deleteConnectionItem(index);
+    }
+}
+
+void ConnectionsItem::updatePorts(ConnectionItem *item)
+{
+    if (QGraphicsItem *from = item->mConnectFrom.item())
+        from->update();
+    if (QGraphicsItem *to = item->mConnectTo.item())
+        to->update();
 }
 
 void ConnectionsItem::afterSetControlPoints(NodeConnection *cxn)
 {
-    if (ConnectionItem *item = itemFor(cxn)) {
+    if (ConnectionItem *item = itemFor(cxn))
+        updateBounds(item);
+}
+
+void ConnectionsItem::deleteConnectionItem(int index)
+{
+    ConnectionItem *item = mConnectionItems.takeAt(index);
+    NodeConnection *cxn = item->mConnection;
+    mItemByConnection.remove(cxn);
+    mItemsByNode.remove(cxn->mSender, item);
+    mItemsByNode.remove(cxn->mReceiver, item);
+    mItemsByPort.remove(item->mConnectFrom.item(), item);
+    mItemsByPort.remove(item->mConnectTo.item(), item);
+    if (mBatched) {
+        if (item == mActiveItem)
+            mActiveItem = 0;
+        else
+            update(item->mBounds);
+        unindexItem(item);
+    }
+    delete item;
+}
+
+// Batched items aren't in the scene, so repaint and reindex them here.
+void ConnectionsItem::updateBounds(ConnectionItem *item)
+{
+    if (!mBatched || item == mActiveItem) {
         item->updateBounds();
         item->update();
+        return;
     }
+    update(item->mBounds);
+    item->updateBounds();
+    indexItem(item);
+    update(item->mBounds);
+}
+
+// Keeps mItemsByPort up to date with the input/output items the connection
+// is attached to.
+void ConnectionsItem::syncWithNodes(ConnectionItem *item)
+{
+    QGraphicsItem *oldFrom = item->mConnectFrom.item();
+    QGraphicsItem *oldTo = item->mConnectTo.item();
+    item->syncWithNodes();
+    QGraphicsItem *from = item->mConnectFrom.item();
+    QGraphicsItem *to = item->mConnectTo.item();
+    // The port items are cached as pixmaps and draw themselves red when a
+    // connection is bad.
+    updatePorts(item);
+    if (from == oldFrom && to == oldTo)
+        return;
+    if (oldFrom)
+        mItemsByPort.remove(oldFrom, item);
+    if (oldTo && oldTo != oldFrom)
+        mItemsByPort.remove(oldTo, item);
+    if (from)
+        mItemsByPort.insert(from, item);
+    if (to && to != from)
+        mItemsByPort.insert(to, item);
 }
 
 /////
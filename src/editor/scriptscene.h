@@ -21,7 +21,14 @@
 #include "editor_global.h"
 #include "basegraphicsscene.h"
 
+#include <QFont>
 #include <QGraphicsItem>
+#include <QHash>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QTimer>
+
+#define LOD_SIMPLE 0.3
 
 struct InputOrOutputItem
 {
@@ -54,6 +61,7 @@ public:
     QRectF boundingRect() const;
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
     QPainterPath shape() const;
+    bool contains(const QPointF &point) const;
 
     void hoverEnterEvent(QGraphicsSceneHoverEvent *event);
     void hoverMoveEvent(QGraphicsSceneHoverEvent *event);
@@ -70,7 +78,8 @@ public:
 
     ProjectScene *mScene;
     QRectF mBounds;
-    QPainterPath mShape;
+    mutable QPainterPath mShape; // built by shape() when mShapeDirty is set
+    mutable bool mShapeDirty;
     NodeConnection *mConnection;
     InputOrOutputItem mConnectFrom;
     InputOrOutputItem mConnectTo;
@@ -88,17 +97,34 @@ class ConnectionsItem : public QGraphicsItem
 {
 public:
     ConnectionsItem(ProjectScene *scene, QGraphicsItem *parent = 0);
+    ~ConnectionsItem();
+
+    // In batched mode the ConnectionItems aren't added to the scene.  This
+    // item draws all of them and hit-tests them using a grid, and only the
+    // connection under the mouse is added to the scene so it can be edited.
+    // Must be set before any connections are added.
+    void setBatched(bool batched);
+    bool isBatched() const { return mBatched; }
+
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+    QPainterPath shape() const;
+    bool contains(const QPointF &point) const;
+
+    void hoverEnterEvent(QGraphicsSceneHoverEvent *event);
+    void hoverMoveEvent(QGraphicsSceneHoverEvent *event);
 
-    QRectF boundingRect() const { return QRectF(); }
-    void paint(QPainter *, const QStyleOptionGraphicsItem *, QWidget *) {}
+    ConnectionItem *connectionAt(const QPointF &scenePos) const;
 
     void updateConnections();
+    void updateConnections(BaseNode *node);
     ConnectionItem *itemFor(NodeConnection *cxn);
     int indexOf(NodeConnection *cxn);
 
     void moved(NodeInputItem *item);
     void moved(NodeOutputItem *item);
 
+    void setMakingConnection(bool making);
     void newConnectionStart(const QPointF &scenePos);
     void newConnectionHotspot(const QPointF &scenePos);
     void newConnectionClick(const QPointF &scenePos);
@@ -112,8 +138,27 @@ public:
     void afterRemoveConnection(int index, NodeConnection *cxn);
     void afterSetControlPoints(NodeConnection *cxn);
 
+    void deleteConnectionItem(int index);
+    void syncWithNodes(ConnectionItem *item);
+    void updatePorts(ConnectionItem *item);
+    void updateBounds(ConnectionItem *item);
+    void movedPort(QGraphicsItem *item);
+
+    void indexItem(ConnectionItem *item);
+    void unindexItem(ConnectionItem *item);
+    void setActiveItem(ConnectionItem *item);
+
     ProjectScene *mScene;
     QList<ConnectionItem*> mConnectionItems;
+    QHash<NodeConnection*,ConnectionItem*> mItemByConnection;
+    QMultiHash<BaseNode*,ConnectionItem*> mItemsByNode; // sender and receiver -> items
+    QMultiHash<QGraphicsItem*,ConnectionItem*> mItemsByPort; // input/output item -> items
+
+    bool mBatched;
+    QRectF mBatchBounds; // grows only
+    QMultiHash<quint64,ConnectionItem*> mItemsByCell;
+    QHash<ConnectionItem*,QRectF> mIndexedBounds; // the bounds each item is indexed under
+    ConnectionItem *mActiveItem; // the one item in the scene in batched mode
 
     QPolygonF mNewConnectionPoints;
     QGraphicsPathItem *mNewConnectionItem;
@@ -170,6 +215,16 @@ public:
 
     QRectF boundsOfAllNodes();
 
+    // Level of detail for an item's paint().  Below LOD_SIMPLE items draw
+    // plain shapes with thin unantialiased lines and no text.
+    static qreal levelOfDetail(QPainter *painter, const QStyleOptionGraphicsItem *option)
+    { return option->levelOfDetailFromTransform(painter->worldTransform()); }
+    bool isTextLegible(qreal lod);
+
+    // QFontMetrics(font()).boundingRect(text), cached.
+    QRect textBounds(const QString &text);
+    QRectF textBoundsF(const QString &text);
+
     NodeInputItem *rootInputItem(const QString &name);
     NodeOutputItem *rootOutputItem(const QString &name);
 
@@ -212,9 +267,27 @@ public slots:
     void infoChanged(ScriptInfo *info);
     void infoChanged(LuaInfo *info);
 
+private slots:
+    void populateSome();
+
 private:
+    void populateNode(int index);
+    void finishPopulating();
+
+    void insertNodeItem(int index, NodeItem *item);
+    void removeNodeItem(int index);
+    void registerNodeItem(NodeItem *item);
+    void variableRefsChanged(BaseNode *node);
+
     ProjectDocument *mDocument;
-    QList<NodeItem*> mNodeItems;
+    QList<NodeItem*> mNodeItems; // NULL for nodes that are still pending
+    QList<int> mPendingNodes; // indices of nodes without an item yet
+    QTimer mPopulateTimer;
+    QHash<BaseNode*,NodeItem*> mItemByNode;
+    QMultiHash<const void*,NodeItem*> mNodeItemsByInfo; // LuaInfo etc -> items using it
+    QFont mMetricsFont; // the font mTextBounds* were measured with
+    QHash<QString,QRect> mTextBounds;
+    QHash<QString,QRectF> mTextBoundsF;
     ConnectionsItem *mConnectionsItem;
     InputOrOutputItem mConnectFrom;
     InputOrOutputItem mConnectTo;
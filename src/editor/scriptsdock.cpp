@@ -42,7 +42,7 @@ ScriptsDock::ScriptsDock(QWidget *parent) :
     mModel = new QFileSystemModel;
     mModel->setFilter(QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Files);
     QStringList filters;
-    filters << QLatin1String("*.pzs");
+    filters << QLatin1String("*.pzs") << QLatin1String("*.pzsb");
     mModel->setNameFilters(filters);
     mModel->setNameFilterDisables(false); // hide filtered files
     t->setModel(mModel);
@@ -24,31 +24,34 @@ const QString ScriptVariable::TypeSeparator = QLatin1String(",");
 ScriptVariable::ScriptVariable(const QString &type, const QString &name,
                                const QString &label, const QString &value) :
     mNode(0),
-    mType(type),
-    mName(name),
-    mLabel(label),
+    mType(symbol(type)),
+    mName(symbol(name)),
+    mLabel(symbol(label)),
     mValue(value),
     mVariableRefNodeID(-1)
 {
     Q_ASSERT(mLabel.size());
+    setType(mType);
 }
 
 ScriptVariable::ScriptVariable(const QString &type, const QString &name,
                                const QString &label,
                                int refNodeID, const QString &refVarName) :
     mNode(0),
-    mType(type),
-    mName(name),
-    mLabel(label),
+    mType(symbol(type)),
+    mName(symbol(name)),
+    mLabel(symbol(label)),
     mVariableRefNodeID(refNodeID),
     mVariableRef(refVarName)
 {
     Q_ASSERT(mLabel.size());
+    setType(mType);
 }
 
 ScriptVariable::ScriptVariable(const ScriptVariable *other) :
     mNode(other->mNode),
     mType(other->mType),
+    mTypes(other->mTypes),
     mName(other->mName),
     mLabel(other->mLabel),
     mValue(other->mValue),
@@ -61,6 +64,7 @@ ScriptVariable::ScriptVariable(const ScriptVariable *other) :
 ScriptVariable::ScriptVariable(const ScriptVariable *other, BaseNode *node) :
     mNode(node),
     mType(other->mType),
+    mTypes(other->mTypes),
     mName(other->mName),
     mLabel(other->mLabel),
     mValue(other->mValue),
@@ -70,6 +74,14 @@ ScriptVariable::ScriptVariable(const ScriptVariable *other, BaseNode *node) :
     Q_ASSERT(mLabel.size());
 }
 
+void ScriptVariable::setType(const QString &type)
+{
+    mType = symbol(type);
+    mTypes.clear();
+    foreach (const QString &t, mType.split(TypeSeparator, QString::SkipEmptyParts))
+        mTypes += symbol(t);
+}
+
 bool ScriptVariable::isKnown() const
 {
     return mNode && mNode->isKnown(this);
@@ -77,9 +89,8 @@ bool ScriptVariable::isKnown() const
 
 bool ScriptVariable::acceptsType(ScriptVariable *other) const
 {
-    QStringList myTypes = types();
-    foreach (QString otherType, other->types())
-        if (!myTypes.contains(otherType))
+    foreach (const QString &otherType, other->types())
+        if (!mTypes.contains(otherType))
             return false;
 
     return true;
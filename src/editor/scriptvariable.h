@@ -19,6 +19,7 @@
 #define SCRIPTVARIABLE_H
 
 #include "editor_global.h"
+#include "symboltable.h"
 
 #include <QList>
 #include <QStringList>
@@ -34,18 +35,15 @@ public:
     void setNode(BaseNode *node) { mNode = node; }
     BaseNode *node() const { return mNode; }
 
-    void setType(const QString &type) { mType = type; }
+    void setType(const QString &type);
     const QString &type() const { return mType; }
 
-    QStringList types() const
-    {
-        return mType.split(TypeSeparator, QString::SkipEmptyParts);
-    }
+    const QStringList &types() const { return mTypes; }
 
-    void setName(const QString &name) { mName = name; }
+    void setName(const QString &name) { mName = symbol(name); }
     const QString &name() const { return mName; }
 
-    void setLabel(const QString &label) { mLabel = label; }
+    void setLabel(const QString &label) { mLabel = symbol(label); }
     const QString &label() const { return mLabel; }
 
     void setValue(const QString &value) { mValue = value; }
@@ -74,6 +72,7 @@ private:
     BaseNode *mNode;
     QString mName; // --> User-assigned name in a script
     QString mType; // --> Number, String, Actor, etc
+    QStringList mTypes; // mType split on TypeSeparator
     QString mLabel;
     QString mValue; // User-defined value, ignored if mVariableRef is valid
     int mVariableRefNodeID; // ID of node with mVariableRef variable
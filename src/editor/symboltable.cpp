@@ -0,0 +1,129 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "symboltable.h"
+
+#include "node.h"
+#include "project.h"
+#include "scriptvariable.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+
+QMutex SymbolTable::mMutex;
+QSet<QString> SymbolTable::mStrings;
+
+// Rough size of a QString's shared data block holding s.
+static qint64 stringBytes(const QString &s)
+{
+    return 24 + (s.size() + 1) * sizeof(QChar);
+}
+
+QString SymbolTable::intern(const QString &s)
+{
+    if (s.isEmpty())
+        return s;
+    QMutexLocker locker(&mMutex);
+    QSet<QString>::const_iterator it = mStrings.constFind(s);
+    if (it != mStrings.constEnd())
+        return *it;
+    // Don't keep a reference to a QString made with fromRawData() etc.
+    QString copy(s.constData(), s.size());
+    mStrings.insert(copy);
+    return copy;
+}
+
+int SymbolTable::count()
+{
+    QMutexLocker locker(&mMutex);
+    return mStrings.size();
+}
+
+qint64 SymbolTable::bytes()
+{
+    QMutexLocker locker(&mMutex);
+    qint64 bytes = 0;
+    foreach (const QString &s, mStrings)
+        bytes += stringBytes(s);
+    return bytes;
+}
+
+class StringCounter
+{
+public:
+    StringCounter() :
+        mCount(0),
+        mUnsharedBytes(0),
+        mSharedBytes(0)
+    {
+    }
+
+    void add(const QString &s)
+    {
+        if (s.isEmpty())
+            return;
+        ++mCount;
+        mUnsharedBytes += stringBytes(s);
+        if (!mSeen.contains(s.constData())) {
+            mSeen.insert(s.constData());
+            mSharedBytes += stringBytes(s);
+        }
+    }
+
+    int mCount;
+    qint64 mUnsharedBytes;
+    qint64 mSharedBytes;
+    QSet<const QChar*> mSeen;
+};
+
+QString SymbolTable::memoryReport(Project *project)
+{
+    StringCounter counter;
+    foreach (BaseNode *node, project->rootNode()->nodesPlusSelf()) {
+        foreach (NodeInput *input, node->inputs()) {
+            counter.add(input->name());
+            counter.add(input->label());
+        }
+        foreach (NodeOutput *output, node->outputs()) {
+            counter.add(output->name());
+            counter.add(output->label());
+        }
+        foreach (ScriptVariable *var, node->variables()) {
+            counter.add(var->type());
+            counter.add(var->name());
+            counter.add(var->label());
+        }
+        foreach (NodeConnection *cxn, node->connections()) {
+            counter.add(cxn->mOutput);
+            counter.add(cxn->mInput);
+        }
+    }
+
+    return QCoreApplication::translate("SymbolTable",
+                                       "%1 name strings, %2 unique.\n"
+                                       "Unshared: %3 bytes\n"
+                                       "Shared: %4 bytes\n"
+                                       "Saved: %5 bytes\n"
+                                       "Symbol table: %6 strings, %7 bytes")
+            .arg(counter.mCount)
+            .arg(counter.mSeen.size())
+            .arg(counter.mUnsharedBytes)
+            .arg(counter.mSharedBytes)
+            .arg(counter.mUnsharedBytes - counter.mSharedBytes)
+            .arg(count())
+            .arg(bytes());
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2013, Tim Baker <treectrl@users.sf.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include "editor_global.h"
+
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+class Project;
+
+// The names, labels and types of inputs, outputs, variables and connections
+// are interned here.  Equal strings then share one QString, so a big project
+// holds each identifier once, and comparing two of them is a pointer compare
+// inside QString.  Thread-safe, event files are read on worker threads.
+class SymbolTable
+{
+public:
+    static QString intern(const QString &s);
+
+    // The number of unique strings and the bytes they use.
+    static int count();
+    static qint64 bytes();
+
+    // Compares the bytes the project's name strings use against what they
+    // would use if every object held its own copy.
+    static QString memoryReport(Project *project);
+
+private:
+    static QMutex mMutex;
+    static QSet<QString> mStrings;
+};
+
+inline QString symbol(const QString &s)
+{
+    return SymbolTable::intern(s);
+}
+
+#endif // SYMBOLTABLE_H
@@ -197,7 +197,7 @@ WelcomeMode::WelcomeMode(QObject *parent) :
         model->setRootPath(mapsDir.absolutePath());
 
         model->setFilter(QDir::AllDirs | QDir::NoDot | QDir::Files);
-        model->setNameFilters(QStringList() << QLatin1String("*.pzs"));
+        model->setNameFilters(QStringList() << QLatin1String("*.pzs") << QLatin1String("*.pzsb"));
         model->setNameFilterDisables(false); // hide filtered files
 
         ui->treeView->setModel(model);